@@ -0,0 +1,68 @@
+#include <renderer.h>
+
+/*
+BlitBench
+Times blit_8_to_32 against the original overwrite loop on synthetic glyph
+coverage (an antialiased ring, mostly empty and solid runs like real glyphs)
+from 8px to 512px. Prints Mpx/s per kernel and the speedup over the old loop.
+*/
+
+static void blit_8_to_32_reference(Image8 *src, Image *dst, int dx, int dy, uint32_t color){
+	for (int i = 0; i < src->height; i++){
+		for (int j = 0; j < src->width; j++){
+			image_row(dst,dy+i)[dx+j] = (image8_row(src,i)[j]<<24) | color;
+		}
+	}
+}
+
+static void make_glyph(Image8 *g, int size){
+	image8_alloc(g,size,size);
+	float r = size*0.35f;
+	float thickness = MAX(1.0f,size*0.08f);
+	for (int y = 0; y < size; y++){
+		for (int x = 0; x < size; x++){
+			float dx = x+0.5f-size*0.5f;
+			float dy = y+0.5f-size*0.5f;
+			float d = fabsf(sqrtf(dx*dx+dy*dy)-r)-thickness;
+			image8_row(g,y)[x] = CLAMP(0.5f-d,0.0f,1.0f)*255;
+		}
+	}
+}
+
+//runs until at least min_time has passed, returns megapixels per second
+static double time_kernel(int kernel, Image8 *g, Image *dst, double min_time){
+	long long pixels = 0;
+	double t0 = get_time(), t1;
+	do {
+		for (int i = 0; i < 16; i++){
+			switch (kernel){
+				case 0: blit_8_to_32_reference(g,dst,0,0,RGB(255,128,0)); break;
+				case 1: blit_8_to_32(g,dst,0,0,RGBA(255,128,0,255)); break;
+				case 2: blit_8_to_32(g,dst,0,0,RGBA(255,128,0,128)); break;
+			}
+		}
+		pixels += 16LL*g->width*g->height;
+		t1 = get_time();
+	} while (t1-t0 < min_time);
+	return pixels/(t1-t0)/1e6;
+}
+
+int main(int argc, char **argv){
+	int sizes[] = {8,16,32,64,128,256,512};
+	char *names[] = {"reference","opaque","tinted"};
+	printf("Mpx/s\n%-6s %10s %10s %10s %9s %9s\n","size",names[0],names[1],names[2],"x opaque","x tinted");
+	for (int i = 0; i < COUNT(sizes); i++){
+		Image8 g;
+		make_glyph(&g,sizes[i]);
+		Image dst;
+		new_image(&dst,sizes[i],sizes[i]);
+		double mpx[3];
+		for (int k = 0; k < 3; k++){
+			mpx[k] = time_kernel(k,&g,&dst,0.2);
+		}
+		printf("%-6d %10.1f %10.1f %10.1f %8.2fx %8.2fx\n",sizes[i],mpx[0],mpx[1],mpx[2],mpx[1]/mpx[0],mpx[2]/mpx[0]);
+		image8_free(&g);
+		image_free(&dst);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,404 @@
+#include <image.h>
+#include <image_effects.h>
+#include <dictionary.h>
+
+/*
+PipelineBench
+Times the image pipeline and the dictionary on synthetic images at several
+resolutions plus any .png/.jpg reference images given on the command line:
+
+	PipelineBench [-o results.json] [reference.png ...]
+
+Each case runs on a fresh copy of its input (the copy is not timed) until
+MIN_RUNS runs and MIN_TIME seconds have passed, and reports the median and
+p95 in milliseconds and the median throughput in MP/s (lookups/s for
+get_word_type, MB/s for the string hashes). The JSON is stable in field order so results can be checked
+in and diffed. The dictionary cases are skipped if the dictionary file can't
+be opened from the working directory.
+*/
+
+#define MIN_RUNS 5
+#define MAX_RUNS 200
+#define MIN_TIME 0.5
+#define DICTIONARY_PATH "../res/OxfordEnglishDictionary.txt"
+
+enum BenchOp {
+	OP_LOAD,
+	OP_GREYSCALE,
+	OP_BLUR,
+	OP_QUANTIZE,
+	OP_DECOMPOSE,
+	OP_PALETTE,
+	OP_GUIDED,
+	OP_DECOMPOSE_PARALLEL,
+};
+
+static FILE *out;
+static int case_count;
+
+static int compare_double(const void *a, const void *b){
+	double x = *(double *)a, y = *(double *)b;
+	return (x > y) - (x < y);
+}
+
+static void report(char *name, char *input, char *params, int width, int height, double *times, int runs, double work, char *unit){
+	qsort(times,runs,sizeof(*times),compare_double);
+	double median = times[runs/2];
+	double p95 = times[MIN(runs-1,(int)(runs*0.95))];
+	//a single sample has no spread, so it's reported without a p95 rather than with a copy of the median
+	char p95_json[32] = "null", p95_text[32] = "        -";
+	if (runs > 1){
+		snprintf(p95_json,sizeof(p95_json),"%.4f",p95*1e3);
+		snprintf(p95_text,sizeof(p95_text),"%9.3f",p95*1e3);
+	}
+	fprintf(out,"%s\n\t\t{\"name\": \"%s\", \"input\": \"%s\", \"params\": \"%s\", \"width\": %d, \"height\": %d, \"runs\": %d, \"median_ms\": %.4f, \"p95_ms\": %s, \"throughput\": %.4f, \"unit\": \"%s\"}",
+		case_count ? "," : "",name,input,params,width,height,runs,median*1e3,p95_json,work/median,unit);
+	case_count++;
+	fprintf(stderr,"%-22s %-16s %-14s %5dx%-5d median %9.3f ms  p95 %s ms  %10.2f %s\n",name,input,params,width,height,median*1e3,p95_text,work/median,unit);
+}
+
+static void copy_image(Image *dst, Image *src){
+	image_alloc(dst,src->width,src->height);
+	image_copy(dst,src);
+}
+
+static void bench_op(int op, int arg, char *input, Image *src, char *path){
+	char *names[] = {"load_image","img_greyscale","img_gaussian_blur","img_quantize","img_rect_decompose","img_palette_quantize","img_guided_filter","img_rect_decompose_parallel"};
+	char params[64] = "";
+	switch (op){
+		case OP_BLUR: snprintf(params,sizeof(params),"strength=%d",arg); break;
+		case OP_QUANTIZE: snprintf(params,sizeof(params),"divisions=%d",arg); break;
+		case OP_DECOMPOSE:
+		case OP_DECOMPOSE_PARALLEL: snprintf(params,sizeof(params),"min_dim=%d",arg); break;
+		case OP_PALETTE: snprintf(params,sizeof(params),"colors=%d",arg); break;
+		case OP_GUIDED: snprintf(params,sizeof(params),"radius=%d",arg); break;
+	}
+	if (op == OP_LOAD){
+		snprintf(params,sizeof(params),"%s",path+strlen(path)-3);
+	}
+	double times[MAX_RUNS];
+	int runs = 0;
+	double total = 0;
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME)){
+		Image img = {0};
+		if (op != OP_LOAD){
+			copy_image(&img,src);
+		}
+		ColorRects rects = {0};
+		double t0 = get_time();
+		switch (op){
+			case OP_LOAD: load_image(&img,path); break;
+			case OP_GREYSCALE: img_greyscale(&img); break;
+			case OP_BLUR: img_gaussian_blur(&img,arg); break;
+			case OP_QUANTIZE: img_quantize(&img,arg); break;
+			case OP_DECOMPOSE: img_rect_decompose(&img,&rects,arg,0); break;
+			case OP_PALETTE: img_palette_quantize(&img,arg); break;
+			case OP_GUIDED: img_guided_filter(&img,arg); break;
+			case OP_DECOMPOSE_PARALLEL: img_rect_decompose_parallel(&img,&rects,arg,0,0); break;
+		}
+		double t = get_time()-t0;
+		times[runs++] = t;
+		total += t;
+		color_rects_free(&rects);
+		image_free(&img);
+	}
+	report(names[op],input,params,src->width,src->height,times,runs,src->width*src->height/1e6,"MP/s");
+}
+
+//smooth gradients with a few hard-edged discs, close to a photo after blurring
+static void make_synthetic(Image *img, int width, int height){
+	image_alloc(img,width,height);
+	for (int y = 0; y < height; y++){
+		for (int x = 0; x < width; x++){
+			float u = (float)x/width, v = (float)y/height;
+			int r = 255*u, g = 255*v, b = 128+127*sinf(6.0f*(u+v));
+			for (int i = 0; i < 6; i++){
+				float cx = 0.15f+0.14f*i, cy = 0.5f+0.3f*sinf(i*1.7f);
+				float dx = u-cx, dy = v-cy;
+				if (dx*dx+dy*dy < 0.004f*(i+1)){
+					r = 40*i; g = 255-30*i; b = 90;
+				}
+			}
+			image_row(img,y)[x] = RGBA(r,g,b,255);
+		}
+	}
+}
+
+static void save_jpeg(Image *img, char *path){
+	FILE *file = fopen(path,"wb");
+	if (!file){
+		fatal_error("save_jpeg: failed to open %s",path);
+	}
+	struct jpeg_compress_struct info;
+	struct jpeg_error_mgr err;
+	info.err = jpeg_std_error(&err);
+	jpeg_create_compress(&info);
+	jpeg_stdio_dest(&info,file);
+	info.image_width = img->width;
+	info.image_height = img->height;
+	info.input_components = 3;
+	info.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info,90,TRUE);
+	jpeg_start_compress(&info,TRUE);
+	uint8_t *row = malloc_or_die(img->width*3);
+	while (info.next_scanline < info.image_height){
+		uint8_t *p = (uint8_t *)image_row(img,info.next_scanline);
+		for (int x = 0; x < img->width; x++){
+			row[x*3+0] = p[x*4+0];
+			row[x*3+1] = p[x*4+1];
+			row[x*3+2] = p[x*4+2];
+		}
+		jpeg_write_scanlines(&info,&row,1);
+	}
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+	free(row);
+	fclose(file);
+}
+
+static void bench_image(char *input, Image *img){
+	bench_op(OP_GREYSCALE,0,input,img,0);
+	int strengths[] = {2,8,32};
+	for (int i = 0; i < COUNT(strengths); i++){
+		bench_op(OP_BLUR,strengths[i],input,img,0);
+		bench_op(OP_GUIDED,strengths[i]-1,input,img,0);//radius strength-1, as the pipeline maps it
+	}
+	int divisions[] = {2,4,8};
+	for (int i = 0; i < COUNT(divisions); i++){
+		bench_op(OP_QUANTIZE,divisions[i],input,img,0);
+	}
+	int colors[] = {8,16,64};
+	for (int i = 0; i < COUNT(colors); i++){
+		bench_op(OP_PALETTE,colors[i],input,img,0);
+	}
+	//decompose what the pipeline would hand it: a blurred image quantized both ways, 4 levels (up to 64 colors) or a 16 color palette, and the guided filter's output with the palette
+	Image q, qp, qg;
+	copy_image(&q,img);
+	copy_image(&qg,img);
+	img_gaussian_blur(&q,8);
+	img_guided_filter(&qg,7);
+	copy_image(&qp,&q);
+	img_quantize(&q,4);
+	img_palette_quantize(&qp,16);
+	img_palette_quantize(&qg,16);
+	char levels_input[64], palette_input[64], guided_input[64];
+	snprintf(levels_input,sizeof(levels_input),"%s/levels4",input);
+	snprintf(palette_input,sizeof(palette_input),"%s/palette16",input);
+	snprintf(guided_input,sizeof(guided_input),"%s/guided16",input);
+	int min_dims[] = {1,4};
+	for (int i = 0; i < COUNT(min_dims); i++){
+		bench_op(OP_DECOMPOSE,min_dims[i],levels_input,&q,0);
+		bench_op(OP_DECOMPOSE,min_dims[i],palette_input,&qp,0);
+		bench_op(OP_DECOMPOSE,min_dims[i],guided_input,&qg,0);
+		bench_op(OP_DECOMPOSE_PARALLEL,min_dims[i],palette_input,&qp,0);
+		bench_op(OP_DECOMPOSE_PARALLEL,min_dims[i],guided_input,&qg,0);
+	}
+	image_free(&q);
+	image_free(&qp);
+	image_free(&qg);
+}
+
+enum HashOp {
+	HASH_FNV_1A,
+	HASH_64,
+	HASH_SCAN_THEN_HASH,
+	HASH_64_ALPHA_NUMERIC,
+};
+
+//the first two hash each word of a list, the others find and hash every alphanumeric run in text, as a tokenizer would
+static void bench_hash(int op, char *input, String *words, int word_count, char *text, int size){
+	char *names[] = {"fnv_1a","hash64","scan+hash64","hash64_alpha_numeric"};
+	double bytes = 0;
+	for (int i = 0; i < word_count; i++){
+		bytes += words[i].len;
+	}
+	if (op >= HASH_SCAN_THEN_HASH) bytes = size;
+	double times[MAX_RUNS];
+	int runs = 0;
+	double total = 0;
+	volatile uint64_t sink = 0;
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME)){
+		uint64_t h = 0;
+		double t0 = get_time();
+		switch (op){
+			case HASH_FNV_1A: for (int i = 0; i < word_count; i++) h += fnv_1a(words[i].data,words[i].len); break;
+			case HASH_64: for (int i = 0; i < word_count; i++) h += hash64(words[i].data,words[i].len); break;
+			case HASH_SCAN_THEN_HASH:
+				for (char *p = text, *end = text+size; p < end;){
+					char *start = p;
+					while (p < end && is_alpha_numeric(*p)) p++;
+					if (p > start) h += hash64(start,p-start);
+					else p++;
+				}
+				break;
+			case HASH_64_ALPHA_NUMERIC:
+				for (char *p = text, *end = text+size; p < end;){
+					int len;
+					h += hash64_alpha_numeric(p,end,&len);
+					p += MAX(1,len);
+				}
+				break;
+		}
+		double t = get_time()-t0;
+		sink += h;
+		times[runs++] = t;
+		total += t;
+	}
+	char params[32];
+	snprintf(params,sizeof(params),"words=%d",word_count);
+	report(names[op],input,op >= HASH_SCAN_THEN_HASH ? "" : params,0,0,times,runs,bytes/1e6,"MB/s");
+}
+
+static void bench_dictionary(){
+	FILE *f = fopen(DICTIONARY_PATH,"rb");
+	if (!f){
+		fprintf(stderr,"%s not found, skipping dictionary benchmarks\n",DICTIONARY_PATH);
+		return;
+	}
+	fclose(f);
+	double t0 = get_time();
+	parse_dictionary_file();//the table is global, so parsing can only be timed once
+	double t = get_time()-t0;
+	int size;
+	char *text = load_file(DICTIONARY_PATH,&size);
+	report("parse_dictionary_file","dictionary","",0,0,&t,1,size/1e6,"MB/s");
+	fprintf(stderr,"dictionary: %zu bytes once parsed\n",dictionary_size());
+
+	//every alphanumeric run in the file: headwords that hit and definition words that mostly miss
+	int word_count = 0, word_total = 1<<16;
+	int headword_count = 0, headword_total = 1<<16;
+	String *words = malloc_or_die(word_total*sizeof(*words));
+	String *headwords = malloc_or_die(headword_total*sizeof(*headwords));
+	bool line_start = true;
+	for (char *p = text, *end = text+size; p < end;){
+		while (p < end && !is_alpha_numeric(*p)){
+			line_start |= *p == '\n';
+			p++;
+		}
+		char *start = p;
+		while (p < end && is_alpha_numeric(*p)) p++;
+		if (p > start){
+			if (word_count == word_total){
+				word_total *= 2;
+				words = realloc_or_die(words,word_total*sizeof(*words));
+			}
+			string_to_lower(p-start,start);
+			words[word_count].data = start;
+			words[word_count].len = p-start;
+			word_count++;
+			if (line_start){
+				if (headword_count == headword_total){
+					headword_total *= 2;
+					headwords = realloc_or_die(headwords,headword_total*sizeof(*headwords));
+				}
+				headwords[headword_count++] = words[word_count-1];
+				line_start = false;
+			}
+		}
+	}
+	//word-length distributions of dictionary keys and of running text
+	for (int op = HASH_FNV_1A; op <= HASH_64; op++){
+		bench_hash(op,"headwords",headwords,headword_count,0,0);
+		bench_hash(op,"corpus",words,word_count,0,0);
+	}
+	bench_hash(HASH_SCAN_THEN_HASH,"corpus",0,0,text,size);
+	bench_hash(HASH_64_ALPHA_NUMERIC,"corpus",0,0,text,size);
+	double times[MAX_RUNS];
+	int runs = 0;
+	double total = 0;
+	volatile int sink = 0;
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME)){
+		t0 = get_time();
+		for (int i = 0; i < word_count; i++){
+			sink += get_word_type(words[i].data,words[i].len);
+		}
+		t = get_time()-t0;
+		times[runs++] = t;
+		total += t;
+	}
+	char params[32];
+	snprintf(params,sizeof(params),"words=%d",word_count);
+	report("get_word_type","dictionary",params,0,0,times,runs,word_count,"lookups/s");
+	int *types = malloc_or_die(word_count*sizeof(*types));
+	runs = 0;
+	total = 0;
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME)){
+		t0 = get_time();
+		get_word_types(words,word_count,types);
+		t = get_time()-t0;
+		times[runs++] = t;
+		total += t;
+	}
+	for (int i = 0; i < word_count; i++){
+		if (types[i] != get_word_type(words[i].data,words[i].len)){
+			fatal_error("get_word_types disagrees with get_word_type on word %d",i);
+		}
+		if (types[i] && !is_word_prefix(words[i].data,words[i].len-1)){
+			fatal_error("is_word_prefix misses the prefix of word %d",i);
+		}
+	}
+	//one word per kind of ending rule, checked when the dictionary has the stem but not the word
+	static char *stems[][2] = {{"running","run"},{"making","make"},{"tries","try"}};
+	for (int i = 0; i < (int)COUNT(stems); i++){
+		char *word = stems[i][0], *stem = stems[i][1];
+		int type = get_word_type(stem,strlen(stem));
+		if (!type || get_word_type(word,strlen(word))) continue;
+		if (get_stem_word_type(word,strlen(word)) != type){
+			fatal_error("get_stem_word_type(\"%s\") isn't the type of \"%s\"",word,stem);
+		}
+	}
+	report("get_word_types","dictionary",params,0,0,times,runs,word_count,"lookups/s");
+	free(types);
+	free(words);
+	free(headwords);
+	free(text);
+}
+
+int main(int argc, char **argv){
+	out = stdout;
+	int first_reference = 1;
+	if (argc > 2 && !strcmp(argv[1],"-o")){
+		out = fopen(argv[2],"w");
+		if (!out){
+			fatal_error("Failed to open %s",argv[2]);
+		}
+		first_reference = 3;
+	}
+	fprintf(out,"{\n\t\"benchmarks\": [");
+	int sizes[] = {256,1024,2048};
+	for (int i = 0; i < COUNT(sizes); i++){
+		char input[32];
+		snprintf(input,sizeof(input),"synthetic%d",sizes[i]);
+		Image img;
+		make_synthetic(&img,sizes[i],sizes[i]);
+		char png_path[64], jpg_path[64];
+		snprintf(png_path,sizeof(png_path),"bench_%d.png",sizes[i]);
+		snprintf(jpg_path,sizeof(jpg_path),"bench_%d.jpg",sizes[i]);
+		save_png(&img,png_path);
+		save_jpeg(&img,jpg_path);
+		bench_op(OP_LOAD,0,input,&img,png_path);
+		bench_op(OP_LOAD,0,input,&img,jpg_path);
+		remove(png_path);
+		remove(jpg_path);
+		bench_image(input,&img);
+		image_free(&img);
+	}
+	for (int i = first_reference; i < argc; i++){
+		Image img;
+		load_image(&img,argv[i]);
+		char *name = argv[i];
+		for (char *c = argv[i]; *c; c++){
+			if (*c == '/' || *c == '\\') name = c+1;
+		}
+		bench_op(OP_LOAD,0,name,&img,argv[i]);
+		bench_image(name,&img);
+		image_free(&img);
+	}
+	bench_dictionary();
+	fprintf(out,"\n\t]\n}\n");
+	if (out != stdout){
+		fclose(out);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -7,7 +7,14 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <boxer/boxer.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #undef near //fuck deez macros lol
 #undef far
@@ -32,29 +39,61 @@ TSTRUCT(String){
 
 void fatal_error(char *format, ...);
 
+extern volatile int alloc_count;//calls to the *_or_die allocators, from any thread
+
 void *malloc_or_die(size_t size);
 
 void *zalloc_or_die(size_t size);
 
 void *realloc_or_die(void *ptr, size_t size);
 
+//alignment must be a power of two, free the result with aligned_free
+void *aligned_alloc_or_die(size_t alignment, size_t size);
+
+void aligned_free(void *p);
+
 char *load_file(char *path, int *size);
 
 bool is_alpha_numeric(char c);
 
 /*
-rand_int
-From: https://stackoverflow.com/a/822361
-Generates uniform random integers in range [0,n).
+Rng
+xoshiro256** (https://prng.di.unimi.it/), 32 bytes of state. Not shared
+between threads: work that has to come out the same however it's split up
+seeds one generator per work item with rng_seed(&rng,random_seed,item).
 */
-int rand_int(int n);
+TSTRUCT(Rng){
+	uint64_t s[4];
+};
+
+//the seed everything random derives from, set with rand_seed
+extern uint64_t random_seed;
+
+//the same seed and stream always give the same sequence, different streams give unrelated ones
+void rng_seed(Rng *r, uint64_t seed, uint64_t stream);
+
+uint64_t rng_next(Rng *r);
+
+/*
+rng_below
+Uniform integer in [0,n) for n > 0, by Lemire's multiply-shift with
+rejection (https://arxiv.org/abs/1805.10941): no division except on the
+rare rejection path.
+*/
+uint32_t rng_below(Rng *r, uint32_t n);
+
+//sets random_seed, generators seeded after this derive from it
+void rand_seed(uint64_t seed);
+
+//uniform random integers in range [0,n) from r
+int rand_int(Rng *r, int n);
 
 /*
 rand_int_range
-Generates uniform random integers in range [min,max],
+Generates uniform random integers in range [min,max] from r,
 where min >= 0 and max >= min.
 */
-int rand_int_range(int min, int max);
+int rand_int_range(Rng *r, int min, int max);
 
 /*
 fnv_1a
@@ -62,9 +101,201 @@ Fowler
 */
 uint32_t fnv_1a(char *key, int keylen);
 
+/*
+hash64
+Word-at-a-time hash in the style of wyhash: each 8 byte chunk goes through
+one folded 64x64->128 multiply, the last one together with the length, and
+one more multiply finishes, so a typical word costs two or three multiplies
+instead of fnv_1a's one per byte. Keys of up to 8 bytes take at most two
+loads and no loop.
+*/
+uint64_t hash64(char *key, int keylen);
+
+/*
+hash64_alpha_numeric
+Finds the run of is_alpha_numeric characters starting at p (stopping at
+end) and hashes it in the same pass, 8 bytes at a time. Returns
+hash64(p,*len) with the run's length in *len, which is 0 if *p isn't
+alphanumeric.
+*/
+uint64_t hash64_alpha_numeric(char *p, char *end, int *len);
+
 //a proper modulo, handles negative numbers
 int modulo(int i, int m);
 
 void cstr_to_string(char *cstr, String *s);
 
-void string_to_lower(size_t len, char *str);
\ No newline at end of file
+void string_to_lower(size_t len, char *str);
+
+#ifdef _WIN32
+typedef void *Thread;
+typedef struct {void *ptr;} Mutex;//SRWLOCK
+typedef struct {void *ptr;} CondVar;//CONDITION_VARIABLE
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#endif
+
+//hints that p will be read soon, so a cache miss on it overlaps other work
+#ifdef _MSC_VER
+#define PREFETCH(p) _mm_prefetch((char *)(p),_MM_HINT_T0)
+#else
+#define PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+//monotonic seconds
+double get_time();
+
+void thread_create(Thread *t, void (*func)(void *), void *arg);
+
+void thread_join(Thread t);
+
+int cpu_count();
+
+void mutex_init(Mutex *m);
+
+void mutex_lock(Mutex *m);
+
+void mutex_unlock(Mutex *m);
+
+void condvar_init(CondVar *c);
+
+void condvar_wait(CondVar *c, Mutex *m);
+
+void condvar_broadcast(CondVar *c);
+
+/*
+map_scratch_file
+Maps size bytes of a new temporary file in dir (the system temp directory if
+0) into memory, so large buffers are paged to disk instead of the swap file.
+The file is already deleted or deleted on unmap. Returns 0 on failure.
+*/
+void *map_scratch_file(char *dir, size_t size);
+
+void unmap_scratch_file(void *p, size_t size);
+
+//drops the whole pages in [p,p+size) of a scratch mapping from memory, their contents stay in the file
+void evict_pages(void *p, size_t size);
+
+#define ARENA_ALIGN 16
+
+TSTRUCT(ArenaBlock){
+	ArenaBlock *next;
+	size_t size;
+};
+
+/*
+Arena
+Linear allocator for temporaries. Allocations are bumped out of one buffer;
+if it runs out they spill into malloc'd overflow blocks, and the next time
+the arena empties the buffer is regrown to the peak so later cycles make no
+heap calls at all. Reset it once per scope (a frame, a pipeline update), or
+use arena_mark/arena_release for nested scopes inside one.
+*/
+TSTRUCT(Arena){
+	char *name;
+	uint8_t *base;
+	size_t capacity, used;
+	size_t overflow_used;//bytes in overflow blocks
+	size_t peak;//most bytes live at once since init
+	ArenaBlock *overflow;
+};
+
+TSTRUCT(ArenaMark){
+	size_t used;
+	ArenaBlock *overflow;
+};
+
+void arena_init(Arena *a, char *name, size_t capacity);
+
+//uninitialized, ARENA_ALIGN aligned, never fails
+void *arena_alloc(Arena *a, size_t size);
+
+void *arena_zalloc(Arena *a, size_t size);
+
+ArenaMark arena_mark(Arena *a);
+
+//frees everything allocated since m
+void arena_release(Arena *a, ArenaMark m);
+
+void arena_reset(Arena *a);
+
+void arena_free(Arena *a);
+
+//prints the arena's peak use to stdout, so capacities can be sized up front
+void arena_report(Arena *a);
+
+//the calling thread's scratch arena, reset by whoever owns the thread's outer loop
+Arena *scratch_arena();
+
+#define LIST_MIN_CAPACITY 16
+
+//smallest size class holding needed elements: powers of two from LIST_MIN_CAPACITY
+int list_capacity_for(int needed);
+
+/*
+LIST_DEFINE
+Defines a growable array of type called name, with
+	nameReserve(list,capacity)
+	nameMakeRoom(list,count)	appends count uninitialized elements, returns the first
+	nameAppend(list,elements,count)
+	nameClear(list)			keeps the storage so the next fill doesn't regrow
+	nameFree(list)
+A list with arena set grows out of that arena (old storage is left for the
+arena's reset) and has to be zeroed again when the arena resets.
+*/
+#define LIST_DEFINE(type,name)\
+TSTRUCT(name){\
+	int total, used;\
+	type *elements;\
+	Arena *arena;\
+};\
+static inline void name##Reserve(name *list, int capacity){\
+	if (capacity <= list->total) return;\
+	int total = list_capacity_for(capacity);\
+	if (list->arena){\
+		type *elements = arena_alloc(list->arena,total*sizeof(type));\
+		if (list->used) memcpy(elements,list->elements,list->used*sizeof(type));\
+		list->elements = elements;\
+	} else {\
+		list->elements = realloc_or_die(list->elements,total*sizeof(type));\
+	}\
+	list->total = total;\
+}\
+static inline type *name##MakeRoom(name *list, int count){\
+	if (list->used+count > list->total) name##Reserve(list,list->used+count);\
+	list->used += count;\
+	return list->elements+list->used-count;\
+}\
+static inline void name##Append(name *list, type *elements, int count){\
+	memcpy(name##MakeRoom(list,count),elements,count*sizeof(type));\
+}\
+static inline void name##Clear(name *list){\
+	list->used = 0;\
+}\
+static inline void name##Free(name *list){\
+	if (!list->arena) free(list->elements);\
+	list->elements = 0;\
+	list->total = 0;\
+	list->used = 0;\
+}
+
+//sequentially consistent atomics on plain ints
+#ifdef _MSC_VER
+static inline int atomic_load_int(volatile int *p){ return _InterlockedOr((volatile long *)p,0); }
+static inline void atomic_store_int(volatile int *p, int v){ _InterlockedExchange((volatile long *)p,v); }
+static inline int atomic_exchange_int(volatile int *p, int v){ return _InterlockedExchange((volatile long *)p,v); }
+static inline int atomic_add_int(volatile int *p, int v){ return _InterlockedExchangeAdd((volatile long *)p,v)+v; }
+#else
+static inline int atomic_load_int(volatile int *p){ return __atomic_load_n(p,__ATOMIC_SEQ_CST); }
+static inline void atomic_store_int(volatile int *p, int v){ __atomic_store_n(p,v,__ATOMIC_SEQ_CST); }
+static inline int atomic_exchange_int(volatile int *p, int v){ return __atomic_exchange_n(p,v,__ATOMIC_SEQ_CST); }
+static inline int atomic_add_int(volatile int *p, int v){ return __atomic_add_fetch(p,v,__ATOMIC_SEQ_CST); }
+#endif
\ No newline at end of file
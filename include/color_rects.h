@@ -0,0 +1,80 @@
+#pragma once
+
+#include <base.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLOR_RECTS_SSE2
+#include <emmintrin.h>
+#endif
+
+#define COLOR_RECT_MAX_DIM 65535 //sizes are uint16, decompose bigger images in tiles
+#define COLOR_RECTS_MAGIC 0x54435243 //"CRCT"
+#define COLOR_RECTS_VERSION 2
+
+/*
+ColorRects
+Structure of arrays rectangle storage, 10 bytes a rectangle instead of the
+20 of an array of int structs. Coordinates and sizes are uint16, colors are
+uint16 indices into a palette, which holds every distinct color after a
+quantize. If a decomposition ever has more than 65536 colors the indices
+are widened once to plain uint32 colors (index is freed, color is set).
+Coordinates are widened the same way the first time one is past
+UINT16_MAX, for the tiles of images bigger than COLOR_RECT_MAX_DIM.
+*/
+TSTRUCT(ColorRects){
+	int total, used;
+	uint16_t *x, *y;//0 once the coordinates are widened
+	uint32_t *wide_x, *wide_y;//only once widened
+	uint16_t *width, *height;
+	uint16_t *index;//palette index per rectangle, 0 once widened
+	uint32_t *color;//color per rectangle, only once widened
+	int palette_total, palette_used;
+	uint32_t *palette;
+	int lookup_total;
+	int *lookup;//open addressed color -> palette index, -1 empty
+};
+
+void color_rects_clear(ColorRects *r);
+
+void color_rects_free(ColorRects *r);
+
+void color_rects_reserve(ColorRects *r, int capacity);
+
+void color_rects_append(ColorRects *r, int x, int y, int width, int height, uint32_t color);
+
+//appends src's rectangles to r moved by (dx,dy), for putting the tiles of a large image together
+void color_rects_append_moved(ColorRects *r, ColorRects *src, int dx, int dy);
+
+static inline uint32_t color_rects_get_color(ColorRects *r, int i){
+	return r->color ? r->color[i] : r->palette[r->index[i]];
+}
+
+static inline int color_rects_get_x(ColorRects *r, int i){
+	return r->wide_x ? (int)r->wide_x[i] : r->x[i];
+}
+
+static inline int color_rects_get_y(ColorRects *r, int i){
+	return r->wide_y ? (int)r->wide_y[i] : r->y[i];
+}
+
+//bytes held by the rectangle arrays and palette
+size_t color_rects_memory(ColorRects *r);
+
+/*
+color_rects_select
+Writes the indices of rectangles with width*height >= min_area and an
+aspect (width/height) within [min_aspect,max_aspect] to out, which needs
+room for r->used entries, and returns how many there were. Scans eight
+rectangles at a time with SSE2, for the word placement search.
+*/
+int color_rects_select(ColorRects *r, int min_area, float min_aspect, float max_aspect, int *out);
+
+/*
+color_rects_save / color_rects_load
+Compact little endian binary: magic, version, counts, flags for widened
+colors and coordinates, palette, then each array in turn. load returns false if the file is missing or not a
+COLOR_RECTS_VERSION file.
+*/
+void color_rects_save(ColorRects *r, char *path);
+
+bool color_rects_load(ColorRects *r, char *path);
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <renderer.h>
+
+#define COMPOSITE_TILE_SIZE 512
+
+TSTRUCT(PlacedWord){
+	char *string;
+	int len;
+	int x, y;//baseline origin, y down
+	int font_height;
+	uint32_t color;//alpha is opacity
+};
+
+/*
+composite_words
+Software rasterizes words over dst (premultiplied RGBA) in array order, no GPU
+or window needed. dst is cut into COMPOSITE_TILE_SIZE tiles that worker
+threads pull from a shared counter. Each thread opens its own FreeType face
+from font_path and only renders the glyphs that touch its tile, so the output
+is identical to drawing the words serially.
+*/
+void composite_words(Image *dst, PlacedWord *words, int count, char *font_path);
+
+//unpremultiplies img in place and saves it as a png
+void export_composite(Image *img, char *path);
\ No newline at end of file
@@ -2,28 +2,6 @@
 
 #include <base.h>
 
-TSTRUCT(intLinkedHashListBucket){
-	intLinkedHashListBucket *prev, *next;
-	char *key;
-	int keylen;
-	int value;
-};
-
-TSTRUCT(intLinkedHashList){
-	int total, used, tombstones;
-	intLinkedHashListBucket *buckets, *first, *last;
-};
-
-#define TOMBSTONE UINTPTR_MAX
-
-intLinkedHashListBucket *intLinkedHashListGet(intLinkedHashList *list, char *key, int keylen);
-
-intLinkedHashListBucket *intLinkedHashListGetChecked(intLinkedHashList *list, char *key, int keylen);
-
-void intLinkedHashListRemove(intLinkedHashList *list, intLinkedHashListBucket *b);
-
-intLinkedHashListBucket *intLinkedHashListNew(intLinkedHashList *list, char *key, int keylen);
-
 enum WordType {
 	NOUN = 1,
 	VERB = NOUN<<1,
@@ -40,10 +18,41 @@ TSTRUCT(Lexer){
 	char *prev, *cur, *end;
 };
 
+/*
+parse_dictionary_file
+Builds the word->WordType dictionary, a minimized automaton that doesn't
+keep the file's text. It's read-only afterwards, so any number of threads
+can look words up at once.
+*/
 void parse_dictionary_file();
 
 int get_word_type(char *str, int len);
 
+#define WORD_TYPE_BATCH 16
+
+/*
+get_word_types
+types[i] = get_word_type(words[i].data,words[i].len) for count words. The
+words go WORD_TYPE_BATCH at a time, each taking one step down the automaton
+per round while the node it stepped to is prefetched, so the cache misses of
+a batch overlap instead of following one another.
+*/
+void get_word_types(String *words, int count, int *types);
+
+//whether some dictionary word starts with str
+bool is_word_prefix(char *str, int len);
+
+/*
+get_stem_word_type
+The word's type, or if it isn't in the dictionary the type of its stem with
+a plural or tense ending taken off: -s, -es, -ies, -ed, -ied, -ing, with a
+dropped e restored ("making") or a doubled consonant undone ("running").
+*/
+int get_stem_word_type(char *str, int len);
+
+//bytes the dictionary takes once parsed
+size_t dictionary_size();
+
 char *get_word_type_string(int type);
 
 void print_word_type(char *cstr);
\ No newline at end of file
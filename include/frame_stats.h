@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sdf_font.h>
+
+#define FRAME_HISTORY 120 //frames in the rolling histogram
+#define GPU_QUERY_LATENCY 4 //frames a timer query gets before we read it, so reading never stalls
+
+enum GpuPass {
+	GPU_PASS_IMAGES,
+	GPU_PASS_BUTTONS,
+	GPU_PASS_TEXT,
+	GPU_PASS_COUNT
+};
+
+/*
+FrameStats
+CPU frame time, per-pass GPU time from GL_TIME_ELAPSED queries, texture
+upload bytes and allocation counts per frame. Timer queries are only issued
+while the overlay is visible, so the hidden overlay costs two clock reads a
+frame.
+*/
+TSTRUCT(FrameStats){
+	bool visible;
+	GLuint queries[GPU_QUERY_LATENCY][GPU_PASS_COUNT];
+	bool issued[GPU_QUERY_LATENCY];
+	int frame;
+	double frame_start;
+	int alloc_start;
+	float cpu_ms[FRAME_HISTORY];
+	float gpu_ms[FRAME_HISTORY];//sum of the passes, written GPU_QUERY_LATENCY frames late
+	float pass_ms[GPU_PASS_COUNT];//latest result per pass
+	size_t upload_bytes;//last frame
+	int allocs;//last frame
+};
+
+void frame_stats_init(FrameStats *fs);
+
+void frame_stats_begin_frame(FrameStats *fs);
+
+void frame_stats_begin_pass(FrameStats *fs, int pass);
+
+void frame_stats_end_pass(FrameStats *fs, int pass);
+
+//call before swapping, after the last pass
+void frame_stats_end_frame(FrameStats *fs);
+
+//the overlay goes into the caller's button and text batches, top right corner of the window
+void frame_stats_append_rects(FrameStats *fs, RoundedRectInstanceList *rects, int client_width, int client_height);
+
+void frame_stats_append_text(FrameStats *fs, TextureColorVertexList *verts, SDFFont *font, int client_width, int client_height);
\ No newline at end of file
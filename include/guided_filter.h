@@ -0,0 +1,25 @@
+#pragma once
+
+#include <image.h>
+
+#define GUIDED_FILTER_EPSILON 0.01f //variance (channels in 0..1) below which a window is flattened, about +-25 levels
+#define GUIDED_FILTER_PASSES 2 //a single pass keeps a fraction of flat regions' noise as speckle, the second flattens it
+
+/*
+Guided filter
+Edge-preserving smoothing (He et al., Guided Image Filtering) with each
+channel as its own guide. Every pixel is fitted as a*I+b over the window
+around it: where the window's variance is small next to
+GUIDED_FILTER_EPSILON, a goes to 0 and the pixel flattens to the window
+mean like a box blur, across an edge the variance is large, a goes to 1 and
+the edge is kept. The result is the per-pixel a and b averaged over the
+window again, and the whole filter runs GUIDED_FILTER_PASSES times.
+The box filters are running sums streamed row by row, so cost per pixel
+doesn't depend on the radius and memory is 2*radius+1 rows rather than
+whole image planes. It reaches GUIDED_FILTER_PASSES*2*radius pixels in
+each direction. Works in place.
+*/
+
+void img_guided_filter(Image *img, int radius);
+
+void img8_guided_filter(Image8 *img, int radius);
\ No newline at end of file
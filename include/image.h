@@ -6,14 +6,84 @@
 #include <jpeglib.h>
 #include <jerror.h>
 
+/*
+Image, Image8
+stride is the distance between rows, in pixels for Image and bytes for
+Image8, so an image can be a view into a larger one: pixels points at the
+view's top left and stride stays the parent's. Crops, tiles and FreeType
+bitmaps (stride = pitch) are all processed in place this way.
+image_alloc pads rows to IMAGE_ROW_ALIGN bytes and aligns the first row the
+same, so every row starts on a SIMD (and cache line) boundary. Views don't
+own their pixels, only allocated images are freed, with image_free.
+*/
+#define IMAGE_ROW_ALIGN 64
+
 TSTRUCT(Image){
-	int width,height;
+	int width,height,stride;
 	uint32_t *pixels;
 };
 
 TSTRUCT(Image8){
-	int width,height;
+	int width,height,stride;
 	uint8_t *pixels;
 };
 
-void load_image(Image *img, char *path);
\ No newline at end of file
+static inline uint32_t *image_row(Image *img, int y){
+	return img->pixels+(size_t)y*img->stride;
+}
+
+static inline uint8_t *image8_row(Image8 *img, int y){
+	return img->pixels+(size_t)y*img->stride;
+}
+
+/*
+Out-of-core images
+Images over memory_budget/IMAGE_BUDGET_SHARE bytes are allocated in a
+scratch file mapped into memory (map_scratch_file, in scratch_dir) instead
+of on the heap, so a 100k pixel wide print never has to fit in RAM. The
+tiled_* effects process them a band of rows at a time and evict each band
+once it's done, which keeps resident memory near the budget however large
+the image is. Sizes are size_t throughout, width*height overflows int well
+before that.
+*/
+#define IMAGE_BUDGET_SHARE 16 //the pipeline holds about this many full size images at once
+#define DEFAULT_MEMORY_BUDGET ((size_t)2 << 30)
+
+extern size_t memory_budget;//bytes, set from WORDCLOUD_MEMORY_BUDGET_MB by main
+extern char *scratch_dir;//0 for the system temp directory, set from WORDCLOUD_SCRATCH_DIR by main
+
+//whether an image of this size is past the heap limit and gets a scratch file
+bool image_out_of_core(int width, int height, int bytes_per_pixel);
+
+//drops rows [y0,y1) from memory if img lives in a scratch file, a no-op otherwise
+void image_evict_rows(Image *img, int y0, int y1);
+
+void image8_evict_rows(Image8 *img, int y0, int y1);
+
+//uninitialized
+void image_alloc(Image *img, int width, int height);
+
+void image8_alloc(Image8 *img, int width, int height);
+
+void image_free(Image *img);
+
+void image8_free(Image8 *img);
+
+//the rectangle must lie inside img
+Image image_view(Image *img, int x, int y, int width, int height);
+
+Image8 image8_view(Image8 *img, int x, int y, int width, int height);
+
+//dst must already be src's size
+void image_copy(Image *dst, Image *src);
+
+void image8_copy(Image8 *dst, Image8 *src);
+
+void image_clear(Image *img);
+
+void image8_clear(Image8 *img);
+
+void load_image(Image *img, char *path);
+
+//writes img as an 8-bit RGBA png, row 0 at the top
+void save_png(Image *img, char *path);
\ No newline at end of file
@@ -2,27 +2,29 @@
 
 #include <image.h>
 #include <cglm/cglm.h>
+#include <color_rects.h>
+#include <palette.h>
+#include <guided_filter.h>
 
-TSTRUCT(ColorRect){
-	int left,top,right,bottom;
-	uint32_t color;
-};
+LIST_DEFINE(ivec2,ivec2List)
 
-TSTRUCT(ColorRectList){
-	int total,used;
-	ColorRect *elements;
-};
+//everything here follows image strides, so any of it can run in place on a view of a crop or tile
 
-TSTRUCT(ivec2List){
-	int total,used;
-	ivec2 *elements;
+/*
+Cancel
+Lets a long effect stop partway once the job it belongs to is superseded:
+it's set when *counter no longer holds value. Effects that take one check
+it between pieces of work and leave their output unfinished, a null
+Cancel is never set.
+*/
+TSTRUCT(Cancel){
+	volatile int *counter;
+	int value;
 };
 
-ColorRect *ColorRectListMakeRoom(ColorRectList *list, int count);
-
-ivec2 *ivec2ListMakeRoom(ivec2List *list, int count);
-
-void ivec2ListAppend(ivec2List *list, ivec2 *elements, int count);
+static inline bool cancelled(Cancel *c){
+	return c && atomic_load_int(c->counter) != c->value;
+}
 
 void img_alpha255(Image *img);
 
@@ -32,4 +34,82 @@ void img_gaussian_blur(Image *img, int strength);
 
 void img_quantize(Image *img, int divisions);
 
-void img_rect_decompose(Image *img, ColorRectList *crl, int min_dim);
\ No newline at end of file
+//img_quantize in two halves so the range can be gathered over several tiles first: widens mins/maxes to img's channel ranges
+void img_channel_range(Image *img, int mins[3], int maxes[3]);
+
+//quantizes as if mins/maxes were img's channel ranges
+void img_quantize_range(Image *img, int divisions, int mins[3], int maxes[3]);
+
+//converts premultiplied alpha to straight alpha
+void img_unpremultiply(Image *img);
+
+//allocates dst with image_alloc as src downsampled by 2 in each dimension with a 2x2 box filter
+void img_half(Image *dst, Image *src);
+
+//img_half into an existing dst of MAX(1,size/2) in each dimension
+void img_half_into(Image *dst, Image *src);
+
+/*
+img_rect_decompose
+Appends the rectangles to rects. An img over COLOR_RECT_MAX_DIM on a side
+is decomposed in tiles of at most that, rectangles stopping at the tile
+edges, and rects widens its coordinates for the tiles past the first.
+The colors come from random stream stream of random_seed, callers that
+decompose one image in pieces pass each piece its own index so the pieces
+don't repeat each other's colors; tiles here take stream, stream+1...
+The same goes for all the rect_decompose functions.
+*/
+void img_rect_decompose(Image *img, ColorRects *rects, int min_dim, uint64_t stream);
+
+#define RECT_STRIPE_MIN_ROWS 64 //shorter stripes would cut too many rectangles for the merge to be worth the threads
+#define RECT_STRIPE_MIN_PIXELS (1<<20) //a few ms of scanning, far more than starting a thread, so small images and previews don't pay for seams
+#define RECT_STRIPE_COUNT 16 //enough stripes to keep most machines' cores busy as they finish unevenly
+
+/*
+img_rect_decompose_parallel
+img_rect_decompose on RECT_STRIPE_COUNT horizontal stripes (fewer on short
+or small images, and none under 2*RECT_STRIPE_MIN_PIXELS, which go to
+img_rect_decompose as they are) that the cores take in turn, with the rectangles that meet at a
+seam in the same color and x extent joined back together afterwards. The
+stripes depend only on the image, so the output is the same on any
+machine. Seams go on the rows that change most from the row above near
+their even spacing. A rectangle the serial scan would have grown across a
+seam still comes out as two when the stripe below starts its piece at a
+different x, and a piece shorter than min_dim on both sides is lost, so
+large flat regions give a few more rectangles and a little less coverage
+than img_rect_decompose. Stripes and tiles stop being started once cancel
+is set.
+*/
+void img_rect_decompose_parallel(Image *img, ColorRects *rects, int min_dim, uint64_t stream, Cancel *cancel);
+
+/*
+Single channel versions for greyscale runs, a quarter of the memory traffic.
+Each gives the same values as the RGBA version does in every color channel.
+*/
+
+//dst must already be src's size
+void img_to_grey8(Image8 *dst, Image *src);
+
+void img8_gaussian_blur(Image8 *img, int strength);
+
+void img8_quantize(Image8 *img, int divisions);
+
+void img8_range(Image8 *img, int *min, int *max);
+
+void img8_quantize_range(Image8 *img, int divisions, int min, int max);
+
+//allocates dst with image8_alloc
+void img8_half(Image8 *dst, Image8 *src);
+
+void img8_half_into(Image8 *dst, Image8 *src);
+
+/*
+img8_rect_decompose
+Rectangle colors are the grey value repeated in RGB with alpha 255. img is
+left as it is and dst, img's size, is painted with the same random colors
+the RGBA version gives the same rectangles, so greyscale runs still end in
+a colored decomposition.
+*/
+void img8_rect_decompose(Image8 *img, Image *dst, ColorRects *rects, int min_dim, uint64_t stream);
+
+void img8_rect_decompose_parallel(Image8 *img, Image *dst, ColorRects *rects, int min_dim, uint64_t stream, Cancel *cancel);
\ No newline at end of file
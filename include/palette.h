@@ -0,0 +1,54 @@
+#pragma once
+
+#include <image.h>
+
+#define PALETTE_BITS 5 //histogram precision per channel
+#define PALETTE_BINS (1 << 3*PALETTE_BITS)
+#define PALETTE_MAX 256
+#define PALETTE_ITERATIONS 16 //k-means usually settles in well under this
+
+/*
+Palette quantization
+img_quantize splits each channel into evenly spaced levels independently,
+up to divisions^3 colors that fragment regions. This picks colors colors
+for the whole image instead: pixels are counted into a PALETTE_BITS per
+channel histogram, k-means runs on the non-empty bins (weighted by their
+pixel counts, in Oklab so distances are perceptual) rather than on pixels,
+and every bin gets its nearest palette color in a lookup table that the
+pixels are then mapped through. Cost is two passes over the pixels plus
+bins*colors work that doesn't grow with the image.
+Palette colors are the mean sRGB color of their bins' pixels. Seeding is
+deterministic (heaviest bin, then greedy weighted farthest bins), so the
+same image always gets the same palette.
+*/
+TSTRUCT(ColorHistogram){
+	uint64_t count[PALETTE_BINS];
+	uint64_t sum[PALETTE_BINS][3];
+};
+
+TSTRUCT(Palette){
+	int count;
+	uint32_t colors[PALETTE_MAX];//alpha 0, the pixels keep theirs
+	uint8_t lut[PALETTE_BINS];//bin -> nearest palette color
+};
+
+void histogram_clear(ColorHistogram *h);
+
+void histogram_add(ColorHistogram *h, Image *img);
+
+//at most colors colors (fewer if the histogram has fewer non-empty bins), colors <= PALETTE_MAX
+void palette_build(Palette *p, ColorHistogram *h, int colors);
+
+void palette_apply(Palette *p, Image *img);
+
+void img_palette_quantize(Image *img, int colors);
+
+//greyscale runs: the same in one dimension over a 256 bin histogram of grey values
+void grey_histogram_add(uint64_t hist[256], Image8 *img);
+
+//lut maps every grey straight to its palette grey
+void grey_palette_build(uint8_t lut[256], uint64_t hist[256], int colors);
+
+void grey_palette_apply(uint8_t lut[256], Image8 *img);
+
+void img8_palette_quantize(Image8 *img, int colors);
\ No newline at end of file
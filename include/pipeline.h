@@ -0,0 +1,109 @@
+#pragma once
+
+#include <image_effects.h>
+
+enum PipelineStage {
+	STAGE_SOURCE,
+	STAGE_BLUR,
+	STAGE_QUANTIZE,
+	STAGE_DECOMPOSE,
+	STAGE_WORDS,
+	STAGE_COUNT
+};
+
+enum StageStatus {
+	STAGE_DONE,
+	STAGE_QUEUED,
+	STAGE_PREVIEW,//low resolution result is up, full resolution is queued or running
+	STAGE_RUNNING
+};
+
+TSTRUCT(PipelineParams){
+	bool greyscale;
+	int gaussianBlurStrength;//guided filter radius + 1 with guidedFilter on
+	int quantizeDivisions;//palette size with paletteQuantize on, levels per channel otherwise
+	int rectangleDecomposeMinDim;
+	bool paletteQuantize;
+	bool guidedFilter;//edge-preserving blur
+};
+
+#define STAGE_BUFFER_FRESH 4
+
+#define PREVIEW_SIZE 512 //longest side of the low resolution pass
+#define STAGE_LEVEL_MIN_SIZE 2048 //levels are halved down to this on a side, the size of a renderer tile
+#define STAGE_LEVELS 15
+#define PREVIEW_CACHE_SIZE 16
+
+/*
+StageImage
+One stage's output. Runs with greyscale on switch to the single channel
+grey image at the blur stage and stay there up to the decomposition, which
+paints random colors into the RGBA image like a color run does. The RGBA
+image is only used when grey is false. Both keep their storage when
+unused so toggling greyscale doesn't reallocate.
+The worker also builds the 2x downsampled levels the renderer draws zoomed
+out views from, band by band for out of core images, and publishes them
+with the stage so the render thread only uploads.
+*/
+TSTRUCT(StageImage){
+	bool grey;
+	int generation;//of the job that published it, a preview newer than the full resolution image replaces it on screen
+	int source_width, source_height;//full resolution size, previews are drawn stretched to it
+	Image rgba;
+	Image8 grey8;
+	int level_count;
+	Image rgba_levels[STAGE_LEVELS];//rgba_levels[0] is rgba halved, each one after is the one before halved
+	Image8 grey_levels[STAGE_LEVELS];
+};
+
+TSTRUCT(PreviewCacheEntry){
+	bool used;
+	PipelineParams params;
+	int last_used;
+	StageImage stages[STAGE_COUNT];
+};
+
+/*
+StageBuffer
+Triple buffer holding one stage's output. The worker fills images[back] and
+swaps it into middle with the fresh bit set, the render thread swaps its
+front with middle whenever the fresh bit is set. Neither side ever waits.
+Previews go through a second set of buffers so neither set changes size
+from one update to the next.
+*/
+TSTRUCT(StageBuffer){
+	StageImage images[3];
+	int back, front;
+	volatile int middle;
+	int latest;//worker side: last published image, the input of the next stage
+	volatile int status;
+};
+
+//starts the worker thread
+void pipeline_start();
+
+//cancels any running job and joins the worker thread
+void pipeline_stop();
+
+/*
+pipeline_submit
+Queues a run of every stage >= first_stage with params and aborts the job in
+flight at its next stage boundary, or sooner in the tiled effects and the
+decompositions, which check between bands, tiles and stripes. Each job first
+publishes a result computed on a PREVIEW_SIZE copy of the source (cached per
+params), then refines it at full resolution. If source_path is non-null the worker loads the image there
+with load_image and everything is recomputed from it.
+*/
+void pipeline_submit(PipelineParams *params, int first_stage, char *source_path);
+
+/*
+pipeline_acquire
+Render thread only. Returns the newest finished image of stage, or of its
+preview, if one was published since the last call, otherwise 0. The returned
+image stays valid until the next call with the same stage and preview.
+*/
+StageImage *pipeline_acquire(int stage, bool preview);
+
+int pipeline_stage_status(int stage);
+
+char *get_stage_name(int stage);
\ No newline at end of file
@@ -8,9 +8,49 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLEND_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#define BLEND_AVX2
+#include <immintrin.h>
+#endif
+
 TSTRUCT(Texture){
 	GLuint id;
 	int width, height;
+	bool grey;//GL_R8 storage swizzled to grey, opaque
+};
+
+#define TILE_SIZE 2048 //clamped to GL_MAX_TEXTURE_SIZE
+#define TILE_EVICT_FRAMES 120
+
+TSTRUCT(TextureTile){
+	Texture texture;
+	bool stale;
+	int last_used;
+};
+
+TSTRUCT(TiledTextureLevel){
+	Image image;//aliases the image or level handed in, levels past those are built on demand. Holds the size in grey mode too
+	Image8 grey;//pixels in grey mode, same rules
+	bool built;//pixels were made here with img_half and are freed with the level
+	int columns, rows;
+	TextureTile *tiles;
+};
+
+/*
+TiledTexture
+An image split into tile_size textures at a chain of 2x downsampled levels.
+Each tile carries its own mip chain. Tiles are only uploaded when they're
+visible at the level picked for the current on-screen size, so images bigger
+than GL_MAX_TEXTURE_SIZE can be drawn at any zoom.
+*/
+TSTRUCT(TiledTexture){
+	int tile_size, level_count;
+	bool grey;//uploaded from Image8 levels as single channel textures
+	TiledTextureLevel levels[16];
 };
 
 TSTRUCT(GPUMesh){
@@ -38,10 +78,7 @@ TSTRUCT(TextureColorVertex){
 	uint32_t color;
 };
 
-TSTRUCT(TextureColorVertexList){
-	int total, used;
-	TextureColorVertex *elements;
-};
+LIST_DEFINE(TextureColorVertex,TextureColorVertexList)
 
 TSTRUCT(TextureColorShader){
 	char *vert_src;
@@ -54,17 +91,34 @@ TSTRUCT(TextureColorShader){
 	GLint uTex;
 } texture_color_shader;
 
-TSTRUCT(RoundedRectVertex){
-	float Position[3];
-	float Rectangle[4];
+TSTRUCT(SDFTextShader){
+	char *vert_src;
+	char *frag_src;
+	GLuint id;
+	GLint aPosition;
+	GLint aTexCoord;
+	GLint aColor;
+	GLint uMVP;
+	GLint uTex;
+} sdf_text_shader;
+
+TSTRUCT(RoundedRectInstance){
+	float Rectangle[4];//xy: center, zw: half extents
+	float Depth;
 	float RoundingRadius;
 	uint32_t color;
 	uint32_t IconColor;
 };
 
-TSTRUCT(RoundedRectVertexList){
-	int total, used;
-	RoundedRectVertex *elements;
+LIST_DEFINE(RoundedRectInstance,RoundedRectInstanceList)
+
+/*
+RoundedRectBatch
+A static unit quad plus a streamed per-instance buffer, so any number of
+rounded rects go out in a single instanced draw call.
+*/
+TSTRUCT(RoundedRectBatch){
+	GLuint vao, quad_vbo, instance_vbo;
 };
 
 enum RoundedRectangleType {
@@ -87,8 +141,9 @@ TSTRUCT(RoundedRectShader){
 	char *vert_src;
 	char *frag_src;
 	GLuint id;
-	GLint aPosition;
+	GLint aCorner;
 	GLint aRectangle;
+	GLint aDepth;
 	GLint aRoundingRadius;
 	GLint aColor;
 	GLint aIconColor;
@@ -100,8 +155,24 @@ void load_image(Image *img, char *path);
 GLenum glCheckError_(const char *file, int line);
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
+extern size_t upload_bytes;//texture bytes sent to the GPU, the frame stats reset it every frame
+
 void texture_from_image(Texture *t, Image *i);
 
+/*
+texture_update_from_image
+Uploads i into t, reusing t's texture object. Storage is only (re)allocated
+when t is empty or i's size differs, otherwise the pixels are streamed through
+a pixel buffer object and copied in place with glTexSubImage2D.
+*/
+void texture_update_from_image(Texture *t, Image *i);
+
+//same as texture_update_from_image, but t is sized to and filled from the given sub-rectangle of i
+void texture_update_from_region(Texture *t, Image *i, int x, int y, int width, int height);
+
+//single channel version, stored as GL_R8 and swizzled so it samples as opaque grey
+void texture_update_from_region8(Texture *t, Image8 *i, int x, int y, int width, int height);
+
 void texture_from_file(Texture *t, char *path);
 
 void delete_texture(Texture *t);
@@ -112,25 +183,51 @@ void check_program(char *name, char *status_name, GLuint id, GLenum param);
 
 GLuint compile_shader(char *name, char *vert_src, char *frag_src);
 
-TextureColorVertex *TextureColorVertexListMakeRoom(TextureColorVertexList *list, int count);
-
-RoundedRectVertex *RoundedRectVertexListMakeRoom(RoundedRectVertexList *list, int count);
-
-void append_rounded_rect(RoundedRectVertexList *verts, int x, int y, int z, int halfWidth, int halfHeight, float RoundingRadius, uint32_t color, uint32_t IconColor);
+void append_rounded_rect(RoundedRectInstanceList *instances, int x, int y, int z, int halfWidth, int halfHeight, float RoundingRadius, uint32_t color, uint32_t IconColor);
 
 void gpu_mesh_from_color_verts(GPUMesh *m, ColorVertex *verts, int count);
 
 void gpu_mesh_from_texture_color_verts(GPUMesh *m, TextureColorVertex *verts, int count);
 
-void gpu_mesh_from_rounded_rect_verts(GPUMesh *m, RoundedRectVertex *verts, int count);
+void gpu_mesh_from_sdf_text_verts(GPUMesh *m, TextureColorVertex *verts, int count);
+
+void rounded_rect_batch_init(RoundedRectBatch *b);
+
+//uploads the instances and draws them in one call with rounded_rect_shader, which must be in use
+void draw_rounded_rect_batch(RoundedRectBatch *b, RoundedRectInstance *instances, int count);
 
 void delete_gpu_mesh(GPUMesh *m);
 
 void compile_shaders();
 
+//points t at i and its 2x downsampled levels from the pipeline and marks every tile stale.
+//t keeps its textures if i's size didn't change.
+void tiled_texture_set_image(TiledTexture *t, Image *i, Image *levels, int level_count);
+
+//grey version, i is expanded to grey RGB by the texture swizzle instead of on the CPU
+void tiled_texture_set_image8(TiledTexture *t, Image8 *i, Image8 *levels, int level_count);
+
+void delete_tiled_texture(TiledTexture *t);
+
+//draws t into the screen rectangle with bottom-left (x,y), uploading the visible tiles as needed
+void draw_tiled_texture(TiledTexture *t, mat4 proj, float x, float y, float z, float width, float height, int viewport_width, int viewport_height, int frame);
+
 void new_image(Image *i, int width, int height);
 
-void blit_8_to_32(Image8 *src, int sx, int sy, int swidth, int sheight, Image *dst, int dx, int dy, uint32_t color);
+/*
+blend_span_over
+Composites color (rgb, alpha ignored) with per pixel coverage over count
+premultiplied pixels: dst = color*a + dst*(1-a). Runs of 16 (32 with AVX2)
+empty or fully covered pixels are skipped or stored directly.
+*/
+void blend_span_over(uint32_t *dst, uint8_t *coverage, int count, uint32_t color);
+
+//same as blend_span_over, but color's alpha scales the coverage
+void blend_span_over_tinted(uint32_t *dst, uint8_t *coverage, int count, uint32_t color);
+
+//blends src's coverage over dst at (dx,dy) in color, whose alpha is the opacity. dst is premultiplied.
+//Clipped to dst, so blit into a view of dst to clip to a sub-rectangle or use part of src.
+void blit_8_to_32(Image8 *src, Image *dst, int dx, int dy, uint32_t color);
 
 void draw_string(Image *dst, int x, int y, FT_Face font_face, int font_height, uint32_t color, int char_count, char *string);
 
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <renderer.h>
+
+#define SDF_BASE_SIZE 32 //em size in pixels the atlas is stored at
+#define SDF_SUPERSAMPLE 4 //outlines are rasterized this many times larger before the distance transform
+#define SDF_SPREAD 4 //distance in base pixels encoded either side of the outline
+#define SDF_ATLAS_SIZE 512
+
+TSTRUCT(SDFGlyph){
+	bool loaded;
+	int x, y, width, height;//atlas rectangle, includes the spread
+	float left, top, advance;//base pixels, left/top of the atlas rectangle relative to the pen and baseline
+};
+
+/*
+SDFFont
+Signed distance field glyphs generated once per codepoint at SDF_BASE_SIZE
+and packed into a single channel atlas. sdf_text_shader draws them at any
+size, so glyph memory doesn't grow with the number of sizes in use.
+*/
+TSTRUCT(SDFFont){
+	FT_Face face;
+	Image8 atlas;//doubles in height as glyphs are added, up to max_height
+	int shelf_x, shelf_y, shelf_height;
+	int max_height;//GL_MAX_TEXTURE_SIZE
+	bool dirty;
+	GLuint texture;
+	float cap_height;//height of '9' in base pixels, used to center text like draw_string_centered
+	SDFGlyph glyphs[256];
+};
+
+void sdf_font_init(SDFFont *f, FT_Face face);
+
+SDFGlyph *sdf_get_glyph(SDFFont *f, unsigned char c);
+
+float sdf_string_width(SDFFont *f, float font_height, int char_count, char *string);
+
+//appends two triangles per glyph, x,y is the pen position on the baseline with y up. Texture coordinates are in atlas texels
+void append_sdf_string(TextureColorVertexList *verts, SDFFont *f, float x, float y, float z, float font_height, uint32_t color, int char_count, char *string);
+
+void append_sdf_string_centered(TextureColorVertexList *verts, SDFFont *f, float x, float y, float z, float font_height, uint32_t color, int char_count, char *string);
+
+//uploads the atlas if glyphs were added since the last call and binds it
+void sdf_font_bind(SDFFont *f);
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <base.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#define MEASURE_HINTED_MAX_SIZE 32 //at or below this pixel size hinting moves advances enough to measure each size exactly
+
+TSTRUCT(TextMetrics){
+	float advance;//sum of the glyph advances, without kerning
+	float kerning;//sum of the pair kerning, add to advance for the kerned width
+	float left, top, right, bottom;//ink bounds of the kerned string relative to the pen start on the baseline, y down
+};
+
+TSTRUCT(MeasureEntry){
+	FT_Face face;
+	int font_height;//0 for entries in font units
+	char *string;
+	int len;
+	uint32_t hash;
+	TextMetrics metrics;
+};
+
+/*
+measure_string
+Returns the metrics of string set at font_height pixels, from a cache keyed
+by (string, face, size). Above MEASURE_HINTED_MAX_SIZE one unhinted entry in
+font units serves every size through linear scaling, so placement searches
+can try any number of sizes without touching FreeType. Not thread safe.
+*/
+void measure_string(TextMetrics *m, FT_Face face, int font_height, int char_count, char *string);
+
+void clear_measure_cache();
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <image_effects.h>
+
+/*
+Tiled effects
+Out-of-core versions of the pipeline stages for images in scratch files.
+Each walks the image in bands of whole rows sized to a share of
+memory_budget: the band (plus a halo of rows for the blurs) is processed
+in memory with the image_effects functions, written to dst, and evicted
+from both images before the next one, so only about one band is ever
+resident. Results match the in-memory effects exactly. Decompositions go
+by fixed DECOMPOSE_TILE_SIZE tiles instead of bands, so their rectangles
+stop at tile edges; the pipeline sends every image bigger than a tile
+here whether it's out of core or not, so the rectangles and colors don't
+depend on the memory budget. A blur band is never
+shorter than a few halos, so for a large strength on a very wide image it
+can take more than its share of the budget.
+dst must already be src's size. dst == src works for all but the blurs.
+Each checks cancel before every band or tile and leaves the rest of dst
+unfinished once it's set.
+*/
+
+void tiled_copy(Image *dst, Image *src, Cancel *cancel);
+
+void tiled8_copy(Image8 *dst, Image8 *src, Cancel *cancel);
+
+void tiled_clear(Image *img, Cancel *cancel);
+
+void tiled8_clear(Image8 *img, Cancel *cancel);
+
+//img_gaussian_blur, or img_guided_filter with radius strength-1 if guided
+void tiled_blur(Image *dst, Image *src, int strength, bool guided, Cancel *cancel);
+
+//greyscale conversion fused into the blur so the RGBA source is only read once
+void tiled_grey8_blur(Image8 *dst, Image *src, int strength, bool guided, Cancel *cancel);
+
+//a pass over src for the channel ranges, then a pass quantizing into dst
+void tiled_quantize(Image *dst, Image *src, int divisions, Cancel *cancel);
+
+void tiled8_quantize(Image8 *dst, Image8 *src, int divisions, Cancel *cancel);
+
+//a histogram pass over src, then a pass mapping into dst through the palette
+void tiled_palette_quantize(Image *dst, Image *src, int colors, Cancel *cancel);
+
+void tiled8_palette_quantize(Image8 *dst, Image8 *src, int colors, Cancel *cancel);
+
+//img_half_into a band of rows at a time, dst must already be half src's size
+void tiled_half(Image *dst, Image *src, Cancel *cancel);
+
+void tiled8_half(Image8 *dst, Image8 *src, Cancel *cancel);
+
+#define DECOMPOSE_TILE_SIZE 4096 //64 MB of RGBA a tile, a fixed grid so the tiles are the same under any budget
+
+/*
+tiled_rect_decompose
+Decomposes each DECOMPOSE_TILE_SIZE tile independently with
+img_rect_decompose_parallel, tile i in raster order taking random stream i,
+and appends the rectangles to rects in image coordinates.
+*/
+void tiled_rect_decompose(Image *dst, Image *src, ColorRects *rects, int min_dim, Cancel *cancel);
+
+//paints dst in color like img8_rect_decompose
+void tiled8_rect_decompose(Image *dst, Image8 *src, ColorRects *rects, int min_dim, Cancel *cancel);
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <base.h>
+
+#define TRACE_RING_SIZE 8192 //events kept per thread, power of two
+#define TRACE_MAX_THREADS 32
+
+TSTRUCT(TraceEvent){
+	char *name;//must outlive the trace, use string literals
+	double start, end;
+};
+
+TSTRUCT(TraceRing){
+	char *thread_name;
+	volatile int head;//total events written, the oldest get overwritten
+	TraceEvent events[TRACE_RING_SIZE];
+};
+
+extern volatile int trace_enabled;
+
+/*
+trace_begin / trace_end
+Scoped timer: double t = trace_begin(); ... trace_end("blur",t);
+The event goes into the calling thread's ring buffer, no locks or allocation
+after a thread's first event, so these stay on in release builds.
+*/
+double trace_begin();
+
+void trace_end(char *name, double start);
+
+//names the calling thread in the trace viewer
+void trace_thread_name(char *name);
+
+/*
+trace_dump
+Writes every thread's buffered events as Chrome trace JSON, loadable in
+chrome://tracing or ui.perfetto.dev. Safe to call while other threads are
+tracing; events they overwrite during the dump are dropped.
+*/
+void trace_dump(char *path);
\ No newline at end of file
@@ -1,4 +1,13 @@
 #include <base.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#endif
 
 void fatal_error(char *format, ...){
 	va_list args;
@@ -10,24 +19,130 @@ void fatal_error(char *format, ...){
 	exit(1);
 }
 
+volatile int alloc_count;
+
 void *malloc_or_die(size_t size){
+	atomic_add_int(&alloc_count,1);
 	void *p = malloc(size);
 	if (!p) fatal_error("malloc failed.");
 	return p;
 }
 
 void *zalloc_or_die(size_t size){
+	atomic_add_int(&alloc_count,1);
 	void *p = calloc(1,size);
 	if (!p) fatal_error("zalloc failed.");
 	return p;
 }
 
 void *realloc_or_die(void *ptr, size_t size){
+	atomic_add_int(&alloc_count,1);
 	void *p = realloc(ptr,size);
 	if (!p) fatal_error("realloc failed.");
 	return p;
 }
 
+void *aligned_alloc_or_die(size_t alignment, size_t size){
+	atomic_add_int(&alloc_count,1);
+#ifdef _WIN32
+	void *p = _aligned_malloc(MAX(1,size),alignment);
+#else
+	void *p = 0;
+	if (posix_memalign(&p,MAX(alignment,sizeof(void *)),MAX(1,size))) p = 0;
+#endif
+	if (!p) fatal_error("aligned_alloc failed.");
+	return p;
+}
+
+void aligned_free(void *p){
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void arena_init(Arena *a, char *name, size_t capacity){
+	memset(a,0,sizeof(*a));
+	a->name = name;
+	a->capacity = capacity;
+	a->base = capacity ? malloc_or_die(capacity) : 0;
+}
+
+void *arena_alloc(Arena *a, size_t size){
+	size = (size+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+	void *p;
+	if (a->used+size <= a->capacity){
+		p = a->base+a->used;
+		a->used += size;
+	} else {
+		ArenaBlock *b = malloc_or_die(sizeof(ArenaBlock)+ARENA_ALIGN+size);
+		b->next = a->overflow;
+		b->size = size;
+		a->overflow = b;
+		a->overflow_used += size;
+		p = (uint8_t *)b+((sizeof(ArenaBlock)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1));
+	}
+	a->peak = MAX(a->peak,a->used+a->overflow_used);
+	return p;
+}
+
+void *arena_zalloc(Arena *a, size_t size){
+	void *p = arena_alloc(a,size);
+	memset(p,0,size);
+	return p;
+}
+
+ArenaMark arena_mark(Arena *a){
+	return (ArenaMark){a->used,a->overflow};
+}
+
+void arena_release(Arena *a, ArenaMark m){
+	while (a->overflow != m.overflow){
+		ArenaBlock *b = a->overflow;
+		a->overflow = b->next;
+		a->overflow_used -= b->size;
+		free(b);
+	}
+	a->used = m.used;
+	if (!a->used && !a->overflow && a->peak > a->capacity){
+		//empty again, grow so the next cycle fits without spilling
+		free(a->base);
+		a->capacity = a->peak;
+		a->base = malloc_or_die(a->capacity);
+	}
+}
+
+void arena_reset(Arena *a){
+	arena_release(a,(ArenaMark){0,0});
+}
+
+void arena_free(Arena *a){
+	arena_reset(a);
+	free(a->base);
+	memset(a,0,sizeof(*a));
+}
+
+void arena_report(Arena *a){
+	printf("arena %s: peak %zu bytes, capacity %zu\n",a->name,a->peak,a->capacity);
+}
+
+int list_capacity_for(int needed){
+	int capacity = LIST_MIN_CAPACITY;
+	while (capacity < needed){
+		if (capacity > INT_MAX/2) return needed;
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+static THREAD_LOCAL Arena scratch;
+
+Arena *scratch_arena(){
+	if (!scratch.name) arena_init(&scratch,"scratch",0);
+	return &scratch;
+}
+
 char *load_file(char *path, int *size){
 	FILE *f = fopen(path,"rb");
 	if (!f){
@@ -46,24 +161,64 @@ bool is_alpha_numeric(char c){
 	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
 }
 
-int rand_int(int n){
-	if ((n - 1) == RAND_MAX){
-		return rand();
-	} else {
-		// Chop off all of the values that would cause skew...
-		int end = RAND_MAX / n; // truncate skew
-		end *= n;
-		// ... and ignore results from rand() that fall above that limit.
-		// (Worst case the loop condition should succeed 50% of the time,
-		// so we can expect to bail out of this loop pretty quickly.)
-		int r;
-		while ((r = rand()) >= end);
-		return r % n;
+uint64_t random_seed;
+
+//https://prng.di.unimi.it/splitmix64.c, spreads a seed over the state so nearby seeds don't give nearby streams
+static uint64_t splitmix64(uint64_t *x){
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+void rng_seed(Rng *r, uint64_t seed, uint64_t stream){
+	uint64_t x = seed;
+	x = splitmix64(&x) ^ stream;
+	for (int i = 0; i < 4; i++){
+		r->s[i] = splitmix64(&x);
 	}
 }
 
-int rand_int_range(int min, int max){
-	return rand_int(max-min+1) + min;
+static uint64_t rotl(uint64_t x, int k){
+	return (x << k) | (x >> (64-k));
+}
+
+uint64_t rng_next(Rng *r){
+	uint64_t *s = r->s;
+	uint64_t result = rotl(s[1]*5,7)*9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3],45);
+	return result;
+}
+
+uint32_t rng_below(Rng *r, uint32_t n){
+	uint64_t m = (rng_next(r) >> 32)*n;
+	uint32_t low = (uint32_t)m;
+	if (low < n){
+		uint32_t threshold = -n % n;//2^32 mod n, the products below it are the ones that would skew
+		while (low < threshold){
+			m = (rng_next(r) >> 32)*n;
+			low = (uint32_t)m;
+		}
+	}
+	return m >> 32;
+}
+
+void rand_seed(uint64_t seed){
+	random_seed = seed;
+}
+
+int rand_int(Rng *r, int n){
+	return rng_below(r,n);
+}
+
+int rand_int_range(Rng *r, int min, int max){
+	return rand_int(r,max-min+1) + min;
 }
 
 uint32_t fnv_1a(char *key, int keylen){
@@ -75,6 +230,109 @@ uint32_t fnv_1a(char *key, int keylen){
 	return index;
 }
 
+#define HASH_SEED 0xa0761d6478bd642full
+#define HASH_MUL 0xe7037ed1a0b428dbull
+#define HASH_FINAL 0x8ebc6af09c88c6e3ull
+
+static uint64_t load64(char *p){
+	uint64_t v;
+	memcpy(&v,p,8);
+	return v;
+}
+
+static uint64_t load32(char *p){
+	uint32_t v;
+	memcpy(&v,p,4);
+	return v;
+}
+
+//the low and high halves of the 128 bit product xor'd together
+static uint64_t folded_multiply(uint64_t a, uint64_t b){
+#ifdef _MSC_VER
+	uint64_t hi;
+	uint64_t lo = _umul128(a,b,&hi);
+	return lo ^ hi;
+#else
+	unsigned __int128 r = (unsigned __int128)a*b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#endif
+}
+
+//the last chunk goes in with the length, and a second multiply spreads it into the low bits tables index with
+static uint64_t hash_finish(uint64_t h, uint64_t last_chunk, int len){
+	return folded_multiply(folded_multiply(h ^ last_chunk,HASH_FINAL ^ (uint64_t)len),HASH_MUL);
+}
+
+//the last 1-8 bytes of a key as one word, without reading past p+len. Overlapping or repeated bytes are fine since the length is mixed in
+static uint64_t load_last(char *p, int len){
+	if (len == 8) return load64(p);
+	if (len >= 4) return load32(p) | load32(p+len-4) << 32;
+	if (len) return (uint8_t)p[0] | (uint8_t)p[len >> 1] << 8 | (uint64_t)(uint8_t)p[len-1] << 16;
+	return 0;
+}
+
+uint64_t hash64(char *key, int keylen){
+	uint64_t h = HASH_SEED;
+	int i = 0;
+	for (; keylen-i > 8; i += 8){
+		h = folded_multiply(h ^ load64(key+i),HASH_MUL);
+	}
+	return hash_finish(h,load_last(key+i,keylen-i),keylen);
+}
+
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+//high bit set in each byte of w in [lo,hi], for bytes below 128 so the adds can't carry between bytes
+static uint64_t bytes_between(uint64_t w, int lo, int hi){
+	return (w+ONES*(128-lo)) & ~(w+ONES*(127-hi)) & HIGHS;
+}
+
+static int lowest_set_byte(uint64_t m){
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i,m);
+	return i/8;
+#else
+	return __builtin_ctzll(m)/8;
+#endif
+}
+
+uint64_t hash64_alpha_numeric(char *p, char *end, int *len){
+	//a full chunk is only known not to be the last once the next one is read, so it waits in last
+	uint64_t h = HASH_SEED, last = 0;
+	int n = 0;
+	while (end-(p+n) >= 8){
+		uint64_t w = load64(p+n);
+		uint64_t ascii = ~w & HIGHS;//non-ASCII bytes aren't alphanumeric
+		uint64_t low = w & ~HIGHS;
+		uint64_t alnum = (bytes_between(low,'0','9') | bytes_between(low,'A','Z') | bytes_between(low,'a','z')) & ascii;
+		if (alnum == HIGHS){
+			if (n) h = folded_multiply(h ^ last,HASH_MUL);
+			last = w;
+			n += 8;
+			continue;
+		}
+		int k = lowest_set_byte(~alnum & HIGHS);
+		if (k){
+			if (n) h = folded_multiply(h ^ last,HASH_MUL);
+			last = load_last(p+n,k);
+			n += k;
+		}
+		*len = n;
+		return hash_finish(h,last,n);
+	}
+	int k = 0;
+	while (p+n+k < end && is_alpha_numeric(p[n+k])) k++;//fewer than 8 bytes are left
+	if (k){
+		if (n) h = folded_multiply(h ^ last,HASH_MUL);
+		last = load_last(p+n,k);
+		n += k;
+	}
+	*len = n;
+	return hash_finish(h,last,n);
+}
+
 int modulo(int i, int m){
 	return (i % m + m) % m;
 }
@@ -89,4 +347,134 @@ void string_to_lower(size_t len, char *str){
 	for (size_t i = 0; i < len; i++){
 		str[i] = tolower(str[i]);
 	}
-}
\ No newline at end of file
+}
+
+TSTRUCT(ThreadStart){
+	void (*func)(void *);
+	void *arg;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI thread_start(LPVOID param){
+	ThreadStart ts = *(ThreadStart *)param;
+	free(param);
+	ts.func(ts.arg);
+	return 0;
+}
+
+void thread_create(Thread *t, void (*func)(void *), void *arg){
+	ThreadStart *ts = malloc_or_die(sizeof(*ts));
+	ts->func = func;
+	ts->arg = arg;
+	*t = CreateThread(0,0,thread_start,ts,0,0);
+	if (!*t) fatal_error("Failed to create thread");
+}
+
+double get_time(){
+	LARGE_INTEGER f, t;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart/f.QuadPart;
+}
+
+void thread_join(Thread t){
+	WaitForSingleObject(t,INFINITE);
+	CloseHandle(t);
+}
+
+int cpu_count(){
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return MAX(1,(int)si.dwNumberOfProcessors);
+}
+
+void mutex_init(Mutex *m){ InitializeSRWLock((PSRWLOCK)m); }
+void mutex_lock(Mutex *m){ AcquireSRWLockExclusive((PSRWLOCK)m); }
+void mutex_unlock(Mutex *m){ ReleaseSRWLockExclusive((PSRWLOCK)m); }
+void condvar_init(CondVar *c){ InitializeConditionVariable((PCONDITION_VARIABLE)c); }
+void condvar_wait(CondVar *c, Mutex *m){ SleepConditionVariableSRW((PCONDITION_VARIABLE)c,(PSRWLOCK)m,INFINITE,0); }
+void condvar_broadcast(CondVar *c){ WakeAllConditionVariable((PCONDITION_VARIABLE)c); }
+
+void *map_scratch_file(char *dir, size_t size){
+	char tmp[MAX_PATH], path[MAX_PATH];
+	if (!dir){
+		if (!GetTempPathA(MAX_PATH,tmp)) return 0;
+		dir = tmp;
+	}
+	if (!GetTempFileNameA(dir,"wcl",0,path)) return 0;
+	HANDLE file = CreateFileA(path,GENERIC_READ|GENERIC_WRITE,0,0,CREATE_ALWAYS,FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE,0);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	HANDLE mapping = CreateFileMappingA(file,0,PAGE_READWRITE,(DWORD)((uint64_t)size >> 32),(DWORD)size,0);
+	void *p = mapping ? MapViewOfFile(mapping,FILE_MAP_ALL_ACCESS,0,0,size) : 0;
+	//the view keeps the mapping and file alive, the file is deleted once it's unmapped
+	if (mapping) CloseHandle(mapping);
+	CloseHandle(file);
+	return p;
+}
+
+void unmap_scratch_file(void *p, size_t size){
+	UnmapViewOfFile(p);
+}
+
+void evict_pages(void *p, size_t size){
+	VirtualUnlock(p,size);//unlocking pages that aren't locked drops them from the working set
+}
+#else
+static void *thread_start(void *param){
+	ThreadStart ts = *(ThreadStart *)param;
+	free(param);
+	ts.func(ts.arg);
+	return 0;
+}
+
+void thread_create(Thread *t, void (*func)(void *), void *arg){
+	ThreadStart *ts = malloc_or_die(sizeof(*ts));
+	ts->func = func;
+	ts->arg = arg;
+	if (pthread_create(t,0,thread_start,ts)) fatal_error("Failed to create thread");
+}
+
+double get_time(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void thread_join(Thread t){
+	pthread_join(t,0);
+}
+
+int cpu_count(){
+	return MAX(1,(int)sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+void mutex_init(Mutex *m){ pthread_mutex_init(m,0); }
+void mutex_lock(Mutex *m){ pthread_mutex_lock(m); }
+void mutex_unlock(Mutex *m){ pthread_mutex_unlock(m); }
+void condvar_init(CondVar *c){ pthread_cond_init(c,0); }
+void condvar_wait(CondVar *c, Mutex *m){ pthread_cond_wait(c,m); }
+void condvar_broadcast(CondVar *c){ pthread_cond_broadcast(c); }
+
+void *map_scratch_file(char *dir, size_t size){
+	char path[4096];
+	if (!dir) dir = getenv("TMPDIR");
+	snprintf(path,sizeof(path),"%s/wordcloud-XXXXXX",dir ? dir : "/tmp");
+	int fd = mkstemp(path);
+	if (fd < 0) return 0;
+	unlink(path);//the mapping keeps the file alive, nothing is left behind if we crash
+	void *p = ftruncate(fd,size) ? MAP_FAILED : mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	return p == MAP_FAILED ? 0 : p;
+}
+
+void unmap_scratch_file(void *p, size_t size){
+	munmap(p,size);
+}
+
+void evict_pages(void *p, size_t size){
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)p+page-1) & ~(page-1);
+	uintptr_t end = ((uintptr_t)p+size) & ~(page-1);
+	if (end > start) madvise((void *)start,end-start,MADV_DONTNEED);//dirty pages of a shared file mapping are kept in the file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include <color_rects.h>
+
+void color_rects_clear(ColorRects *r){
+	r->used = 0;
+	r->palette_used = 0;
+	if (r->wide_x){
+		free(r->wide_x);
+		free(r->wide_y);
+		r->wide_x = r->wide_y = 0;
+		r->x = malloc_or_die(MAX(1,r->total)*sizeof(*r->x));
+		r->y = malloc_or_die(MAX(1,r->total)*sizeof(*r->y));
+	}
+	if (r->lookup) memset(r->lookup,-1,r->lookup_total*sizeof(*r->lookup));
+	if (r->color){
+		//back to indices, the next decomposition probably fits again
+		free(r->color);
+		r->color = 0;
+		r->index = malloc_or_die(MAX(1,r->total)*sizeof(*r->index));
+	}
+}
+
+void color_rects_free(ColorRects *r){
+	free(r->x);
+	free(r->y);
+	free(r->wide_x);
+	free(r->wide_y);
+	free(r->width);
+	free(r->height);
+	free(r->index);
+	free(r->color);
+	free(r->palette);
+	free(r->lookup);
+	memset(r,0,sizeof(*r));
+}
+
+void color_rects_reserve(ColorRects *r, int capacity){
+	if (capacity <= r->total) return;
+	r->total = list_capacity_for(capacity);
+	if (r->wide_x){
+		r->wide_x = realloc_or_die(r->wide_x,r->total*sizeof(*r->wide_x));
+		r->wide_y = realloc_or_die(r->wide_y,r->total*sizeof(*r->wide_y));
+	} else {
+		r->x = realloc_or_die(r->x,r->total*sizeof(*r->x));
+		r->y = realloc_or_die(r->y,r->total*sizeof(*r->y));
+	}
+	r->width = realloc_or_die(r->width,r->total*sizeof(*r->width));
+	r->height = realloc_or_die(r->height,r->total*sizeof(*r->height));
+	if (r->color){
+		r->color = realloc_or_die(r->color,r->total*sizeof(*r->color));
+	} else {
+		r->index = realloc_or_die(r->index,r->total*sizeof(*r->index));
+	}
+}
+
+static uint32_t hash_color(uint32_t c){
+	c ^= c >> 16;
+	c *= 0x7feb352d;
+	c ^= c >> 15;
+	return c;
+}
+
+static void rebuild_lookup(ColorRects *r, int total){
+	free(r->lookup);
+	r->lookup_total = total;
+	r->lookup = malloc_or_die(r->lookup_total*sizeof(*r->lookup));
+	memset(r->lookup,-1,r->lookup_total*sizeof(*r->lookup));
+	for (int i = 0; i < r->palette_used; i++){
+		int slot = hash_color(r->palette[i]) & (r->lookup_total-1);
+		while (r->lookup[slot] >= 0) slot = (slot+1) & (r->lookup_total-1);
+		r->lookup[slot] = i;
+	}
+}
+
+static void widen(ColorRects *r){
+	r->color = malloc_or_die(MAX(1,r->total)*sizeof(*r->color));
+	for (int i = 0; i < r->used; i++){
+		r->color[i] = r->palette[r->index[i]];
+	}
+	free(r->index);
+	r->index = 0;
+}
+
+static void widen_coordinates(ColorRects *r){
+	r->wide_x = malloc_or_die(MAX(1,r->total)*sizeof(*r->wide_x));
+	r->wide_y = malloc_or_die(MAX(1,r->total)*sizeof(*r->wide_y));
+	for (int i = 0; i < r->used; i++){
+		r->wide_x[i] = r->x[i];
+		r->wide_y[i] = r->y[i];
+	}
+	free(r->x);
+	free(r->y);
+	r->x = r->y = 0;
+}
+
+//palette index of c, adding it if it's new, -1 if the palette is full
+static int palette_index(ColorRects *r, uint32_t c){
+	if (r->palette_used*2 >= r->lookup_total) rebuild_lookup(r,r->lookup_total ? r->lookup_total*2 : 256);
+	int slot = hash_color(c) & (r->lookup_total-1);
+	while (r->lookup[slot] >= 0){
+		if (r->palette[r->lookup[slot]] == c) return r->lookup[slot];
+		slot = (slot+1) & (r->lookup_total-1);
+	}
+	if (r->palette_used > UINT16_MAX) return -1;
+	if (r->palette_used == r->palette_total){
+		r->palette_total = list_capacity_for(r->palette_used+1);
+		r->palette = realloc_or_die(r->palette,r->palette_total*sizeof(*r->palette));
+	}
+	r->palette[r->palette_used] = c;
+	r->lookup[slot] = r->palette_used;
+	return r->palette_used++;
+}
+
+void color_rects_append(ColorRects *r, int x, int y, int width, int height, uint32_t color){
+	if (r->used == r->total) color_rects_reserve(r,r->used+1);
+	int i = r->used++;
+	if (!r->wide_x && (x > UINT16_MAX || y > UINT16_MAX)) widen_coordinates(r);
+	if (r->wide_x){
+		r->wide_x[i] = x;
+		r->wide_y[i] = y;
+	} else {
+		r->x[i] = x;
+		r->y[i] = y;
+	}
+	r->width[i] = width;
+	r->height[i] = height;
+	if (!r->color){
+		int index = palette_index(r,color);
+		if (index >= 0){
+			r->index[i] = index;
+			return;
+		}
+		widen(r);
+	}
+	r->color[i] = color;
+}
+
+void color_rects_append_moved(ColorRects *r, ColorRects *src, int dx, int dy){
+	color_rects_reserve(r,r->used+src->used);
+	for (int i = 0; i < src->used; i++){
+		color_rects_append(r,dx+color_rects_get_x(src,i),dy+color_rects_get_y(src,i),src->width[i],src->height[i],color_rects_get_color(src,i));
+	}
+}
+
+size_t color_rects_memory(ColorRects *r){
+	size_t per_rect = 2*sizeof(uint16_t)+(r->wide_x ? 2*sizeof(uint32_t) : 2*sizeof(uint16_t))+(r->color ? sizeof(uint32_t) : sizeof(uint16_t));
+	return r->total*per_rect+r->palette_total*sizeof(*r->palette)+r->lookup_total*sizeof(*r->lookup);
+}
+
+int color_rects_select(ColorRects *r, int min_area, float min_aspect, float max_aspect, int *out){
+	//aspect tests in 8.8 fixed point so they stay integer: width*256 >= lo*height && width*256 <= hi*height
+	uint32_t lo = CLAMP((int)(min_aspect*256),0,UINT16_MAX);
+	uint32_t hi = CLAMP((int)(max_aspect*256+0.999f),0,UINT16_MAX);
+	int count = 0;
+	int i = 0;
+#ifdef COLOR_RECTS_SSE2
+	//unsigned 32 bit compares done signed with the sign bit flipped
+	__m128i bias = _mm_set1_epi32(INT_MIN);
+	__m128i min_area_b = _mm_xor_si128(_mm_set1_epi32(min_area > 0 ? min_area-1 : 0),bias);
+	__m128i lo16 = _mm_set1_epi16(lo), hi16 = _mm_set1_epi16(hi);
+	__m128i zero = _mm_setzero_si128();
+	for (; i+8 <= r->used; i += 8){
+		__m128i w = _mm_loadu_si128((__m128i *)(r->width+i));
+		__m128i h = _mm_loadu_si128((__m128i *)(r->height+i));
+		//16x16->32 bit products from the low and high halves
+		__m128i wh_lo = _mm_mullo_epi16(w,h), wh_hi = _mm_mulhi_epu16(w,h);
+		__m128i lh_lo = _mm_mullo_epi16(lo16,h), lh_hi = _mm_mulhi_epu16(lo16,h);
+		__m128i hh_lo = _mm_mullo_epi16(hi16,h), hh_hi = _mm_mulhi_epu16(hi16,h);
+		uint32_t mask = 0;
+		for (int half = 0; half < 2; half++){
+			__m128i area = half ? _mm_unpackhi_epi16(wh_lo,wh_hi) : _mm_unpacklo_epi16(wh_lo,wh_hi);
+			__m128i low = half ? _mm_unpackhi_epi16(lh_lo,lh_hi) : _mm_unpacklo_epi16(lh_lo,lh_hi);
+			__m128i high = half ? _mm_unpackhi_epi16(hh_lo,hh_hi) : _mm_unpacklo_epi16(hh_lo,hh_hi);
+			__m128i w256 = _mm_slli_epi32(half ? _mm_unpackhi_epi16(w,zero) : _mm_unpacklo_epi16(w,zero),8);
+			__m128i ok = _mm_cmpgt_epi32(_mm_xor_si128(area,bias),min_area_b);
+			ok = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_xor_si128(low,bias),_mm_xor_si128(w256,bias)),ok);
+			ok = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_xor_si128(w256,bias),_mm_xor_si128(high,bias)),ok);
+			mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(ok)) << (half*4);
+		}
+		while (mask){
+			int bit = 0;
+			while (!(mask & (1u << bit))) bit++;
+			out[count++] = i+bit;
+			mask &= mask-1;
+		}
+	}
+#endif
+	for (; i < r->used; i++){
+		uint32_t w = r->width[i], h = r->height[i];
+		if (w*h >= (uint32_t)MAX(0,min_area) && w*256 >= lo*h && w*256 <= hi*h){
+			out[count++] = i;
+		}
+	}
+	return count;
+}
+
+static bool host_little_endian(){
+	uint16_t one = 1;
+	return *(uint8_t *)&one;
+}
+
+static void swap_bytes(void *data, size_t size, size_t count){
+	uint8_t *p = data;
+	for (size_t i = 0; i < count; i++, p += size){
+		for (size_t a = 0, b = size-1; a < b; a++, b--){
+			uint8_t t = p[a];
+			p[a] = p[b];
+			p[b] = t;
+		}
+	}
+}
+
+//the file is little endian, big endian hosts swap each array through a small buffer
+static void write_le(void *data, size_t size, size_t count, FILE *f){
+	if (host_little_endian()){
+		fwrite(data,size,count,f);
+		return;
+	}
+	uint8_t buffer[4096];
+	uint8_t *p = data;
+	while (count){
+		size_t n = MIN(count,sizeof(buffer)/size);
+		memcpy(buffer,p,n*size);
+		swap_bytes(buffer,size,n);
+		fwrite(buffer,size,n,f);
+		p += n*size;
+		count -= n;
+	}
+}
+
+static size_t read_le(void *data, size_t size, size_t count, FILE *f){
+	size_t n = fread(data,size,count,f);
+	if (!host_little_endian()) swap_bytes(data,size,n);
+	return n;
+}
+
+void color_rects_save(ColorRects *r, char *path){
+	FILE *f = fopen(path,"wb");
+	if (!f){
+		fatal_error("color_rects_save: failed to open %s",path);
+	}
+	uint32_t header[5] = {COLOR_RECTS_MAGIC,COLOR_RECTS_VERSION,r->used,r->color ? 0 : r->palette_used,(r->color != 0) | (r->wide_x != 0) << 1};
+	write_le(header,sizeof(*header),COUNT(header),f);
+	if (!r->color) write_le(r->palette,sizeof(*r->palette),r->palette_used,f);
+	if (r->wide_x){
+		write_le(r->wide_x,sizeof(*r->wide_x),r->used,f);
+		write_le(r->wide_y,sizeof(*r->wide_y),r->used,f);
+	} else {
+		write_le(r->x,sizeof(*r->x),r->used,f);
+		write_le(r->y,sizeof(*r->y),r->used,f);
+	}
+	write_le(r->width,sizeof(*r->width),r->used,f);
+	write_le(r->height,sizeof(*r->height),r->used,f);
+	if (r->color) write_le(r->color,sizeof(*r->color),r->used,f);
+	else write_le(r->index,sizeof(*r->index),r->used,f);
+	fclose(f);
+}
+
+bool color_rects_load(ColorRects *r, char *path){
+	FILE *f = fopen(path,"rb");
+	if (!f) return false;
+	uint32_t header[5];
+	if (read_le(header,sizeof(*header),COUNT(header),f) != COUNT(header) || header[0] != COLOR_RECTS_MAGIC || header[1] != COLOR_RECTS_VERSION || header[3] > UINT16_MAX+1){
+		fclose(f);
+		return false;
+	}
+	int used = header[2], palette_used = header[3];
+	bool wide = header[4] & 1, wide_coordinates = header[4] & 2;
+	color_rects_clear(r);
+	if (wide) widen(r);
+	if (wide_coordinates) widen_coordinates(r);
+	color_rects_reserve(r,used);
+	if (palette_used > r->palette_total){
+		r->palette_total = list_capacity_for(palette_used);
+		r->palette = realloc_or_die(r->palette,r->palette_total*sizeof(*r->palette));
+	}
+	size_t n = read_le(r->palette,sizeof(*r->palette),palette_used,f);
+	if (wide_coordinates){
+		n += read_le(r->wide_x,sizeof(*r->wide_x),used,f);
+		n += read_le(r->wide_y,sizeof(*r->wide_y),used,f);
+	} else {
+		n += read_le(r->x,sizeof(*r->x),used,f);
+		n += read_le(r->y,sizeof(*r->y),used,f);
+	}
+	n += read_le(r->width,sizeof(*r->width),used,f);
+	n += read_le(r->height,sizeof(*r->height),used,f);
+	n += wide ? read_le(r->color,sizeof(*r->color),used,f) : read_le(r->index,sizeof(*r->index),used,f);
+	fclose(f);
+	if (n != (size_t)palette_used+5*used){
+		color_rects_clear(r);
+		return false;
+	}
+	r->used = used;
+	r->palette_used = palette_used;
+	//rebuild the lookup so appends keep deduplicating
+	int lookup_total = 256;
+	while (r->palette_used*2 >= lookup_total) lookup_total *= 2;
+	rebuild_lookup(r,lookup_total);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <compositor.h>
+#include <image_effects.h>
+#include <trace.h>
+
+TSTRUCT(WordBounds){
+	int left, top, right, bottom;
+};
+
+TSTRUCT(CompositeJob){
+	Image *dst;
+	PlacedWord *words;
+	WordBounds *bounds;
+	int count;
+	char *font_path;
+	int columns, rows;
+	volatile int next_tile;
+};
+
+static void open_face(char *path, FT_Library *lib, FT_Face *face){
+	if (FT_Init_FreeType(lib)){
+		fatal_error("Failed to initialize freetype");
+	}
+	if (FT_New_Face(*lib,path,0,face)){
+		fatal_error("Failed to load %s",path);
+	}
+}
+
+static void close_face(FT_Library lib, FT_Face face){
+	FT_Done_Face(face);
+	FT_Done_FreeType(lib);
+}
+
+//ink bounds from the glyph metrics, nothing gets rendered
+static void measure_word(FT_Face face, PlacedWord *w, WordBounds *b){
+	if (FT_Set_Pixel_Sizes(face,0,w->font_height)){
+		fatal_error("Failed to set freetype char size.");
+	}
+	b->left = b->top = INT_MAX;
+	b->right = b->bottom = INT_MIN;
+	int x = w->x;
+	for (int i = 0; i < w->len; i++){
+		if (FT_Load_Char(face,w->string[i],FT_LOAD_DEFAULT)){
+			fatal_error("Failed to load freetype glyph");
+		}
+		FT_Glyph_Metrics *m = &face->glyph->metrics;
+		if (m->width && m->height){
+			int left = x + (m->horiBearingX >> 6);
+			int top = w->y - ((m->horiBearingY + 63) >> 6);
+			b->left = MIN(b->left,left);
+			b->top = MIN(b->top,top);
+			b->right = MAX(b->right,left + ((m->width + 63) >> 6) + 1);
+			b->bottom = MAX(b->bottom,top + ((m->height + 63) >> 6) + 1);
+		}
+		x += face->glyph->advance.x >> 6;
+	}
+}
+
+//tile is a view of the destination whose top left is at (left,top)
+static void draw_word_clipped(FT_Face face, PlacedWord *w, Image *tile, int left, int top){
+	int right = left+tile->width, bottom = top+tile->height;
+	if (FT_Set_Pixel_Sizes(face,0,w->font_height)){
+		fatal_error("Failed to set freetype char size.");
+	}
+	int x = w->x;
+	for (int i = 0; i < w->len; i++){
+		if (FT_Load_Char(face,w->string[i],FT_LOAD_DEFAULT)){
+			fatal_error("Failed to load freetype glyph");
+		}
+		FT_Glyph_Metrics *m = &face->glyph->metrics;
+		int gl = x + (m->horiBearingX >> 6);
+		int gt = w->y - ((m->horiBearingY + 63) >> 6);
+		if (m->width && m->height && gl < right && gt < bottom && gl + ((m->width + 63) >> 6) + 1 > left && gt + ((m->height + 63) >> 6) + 1 > top){
+			if (FT_Render_Glyph(face->glyph,FT_RENDER_MODE_NORMAL)){
+				fatal_error("Failed to render freetype glyph");
+			}
+			Image8 glyph_image = {
+				.width = face->glyph->bitmap.width,
+				.height = face->glyph->bitmap.rows,
+				.stride = face->glyph->bitmap.pitch,
+				.pixels = face->glyph->bitmap.buffer
+			};
+			blit_8_to_32(&glyph_image,tile,x+face->glyph->bitmap_left-left,w->y-face->glyph->bitmap_top-top,w->color);
+		}
+		x += face->glyph->advance.x >> 6;
+	}
+}
+
+static void composite_worker(void *arg){
+	CompositeJob *job = arg;
+	FT_Library lib;
+	FT_Face face;
+	open_face(job->font_path,&lib,&face);
+	int tile;
+	while ((tile = atomic_add_int(&job->next_tile,1)-1) < job->columns*job->rows){
+		int left = (tile % job->columns)*COMPOSITE_TILE_SIZE;
+		int top = (tile / job->columns)*COMPOSITE_TILE_SIZE;
+		int right = MIN(left+COMPOSITE_TILE_SIZE,job->dst->width);
+		int bottom = MIN(top+COMPOSITE_TILE_SIZE,job->dst->height);
+		Image view = image_view(job->dst,left,top,right-left,bottom-top);
+		for (int i = 0; i < job->count; i++){
+			WordBounds *b = job->bounds+i;
+			if (b->left < right && b->top < bottom && b->right > left && b->bottom > top){
+				draw_word_clipped(face,job->words+i,&view,left,top);
+			}
+		}
+	}
+	close_face(lib,face);
+}
+
+void composite_words(Image *dst, PlacedWord *words, int count, char *font_path){
+	CompositeJob job = {
+		.dst = dst,
+		.words = words,
+		.count = count,
+		.font_path = font_path,
+		.columns = (dst->width+COMPOSITE_TILE_SIZE-1)/COMPOSITE_TILE_SIZE,
+		.rows = (dst->height+COMPOSITE_TILE_SIZE-1)/COMPOSITE_TILE_SIZE,
+		.next_tile = 0
+	};
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	job.bounds = arena_alloc(scratch,count*sizeof(*job.bounds));
+	double t = trace_begin();
+	FT_Library lib;
+	FT_Face face;
+	open_face(font_path,&lib,&face);
+	for (int i = 0; i < count; i++){
+		measure_word(face,words+i,job.bounds+i);
+	}
+	close_face(lib,face);
+	trace_end("composite measure",t);
+	t = trace_begin();
+	int thread_count = MIN(cpu_count(),job.columns*job.rows);
+	Thread *threads = arena_alloc(scratch,thread_count*sizeof(*threads));
+	for (int i = 1; i < thread_count; i++){
+		thread_create(threads+i,composite_worker,&job);
+	}
+	composite_worker(&job);
+	for (int i = 1; i < thread_count; i++){
+		thread_join(threads[i]);
+	}
+	trace_end("composite tiles",t);//the worker threads are short lived, so only the calling thread records
+	arena_release(scratch,mark);
+}
+
+void export_composite(Image *img, char *path){
+	img_unpremultiply(img);
+	save_png(img,path);
+}
\ No newline at end of file
@@ -1,79 +1,5 @@
 #include <dictionary.h>
 
-intLinkedHashListBucket *intLinkedHashListGet(intLinkedHashList *list, char *key, int keylen){
-	if (!list->total) return 0;
-	int index = fnv_1a(key,keylen) % list->total;
-	intLinkedHashListBucket *tombstone = 0;
-	while (1){
-		intLinkedHashListBucket *b = list->buckets+index;
-		if (b->key == TOMBSTONE) tombstone = b;
-		else if (b->key == 0) return tombstone ? tombstone : b;
-		else if (!memcmp(b->key,key,keylen)) return b;
-		index = (index + 1) % list->total;
-	}
-}
-
-intLinkedHashListBucket *intLinkedHashListGetChecked(intLinkedHashList *list, char *key, int keylen){
-	intLinkedHashListBucket *b = intLinkedHashListGet(list,key,keylen);
-	if (!b || b->key == 0 || b->key == TOMBSTONE) return 0;
-	return b;
-}
-
-void intLinkedHashListRemove(intLinkedHashList *list, intLinkedHashListBucket *b){
-	b->key = TOMBSTONE;
-	if (b->prev) b->prev->next = b->next;
-	if (b->next) b->next->prev = b->prev;
-	if (list->first == b) list->first = b->next;
-	if (list->last == b) list->last = b->prev;
-	list->used--;
-	list->tombstones++;
-}
-
-intLinkedHashListBucket *intLinkedHashListNew(intLinkedHashList *list, char *key, int keylen){
-	if ((list->used+list->tombstones+1) > (list->total*3)/4){ // 3/4 load limit
-		intLinkedHashList newList;
-		newList.total = 16; // same as used resize factor
-		while (newList.total < (list->used*16)) newList.total *= 2; // 16x used resize
-		newList.used = list->used;
-		newList.tombstones = 0;
-		newList.first = 0;
-		newList.last = 0;
-		newList.buckets = zalloc_or_die(newList.total*sizeof(*newList.buckets));
-		for (intLinkedHashListBucket *b = list->first; b; b = b->next){
-			intLinkedHashListBucket *nb = intLinkedHashListGet(&newList,b->key,b->keylen);
-			nb->key = b->key;
-			nb->keylen = b->keylen;
-			nb->value = b->value;
-			if (!newList.first){
-				newList.first = nb;
-				nb->prev = 0;
-			} else {
-				newList.last->next = nb;
-				nb->prev = newList.last;
-			}
-			newList.last = nb;
-			nb->next = 0;
-		}
-		if (list->buckets) free(list->buckets);
-		*list = newList;
-	}
-	intLinkedHashListBucket *b = intLinkedHashListGet(list,key,keylen);
-	b->key = key;
-	b->keylen = keylen;
-	if (!list->first){
-		list->first = b;
-		b->prev = 0;
-	} else {
-		list->last->next = b;
-		b->prev = list->last;
-	}
-	list->last = b;
-	b->next = 0;
-	if (b->key == TOMBSTONE) list->tombstones--;
-	list->used++;
-	return b;
-}
-
 static void get_word(Lexer *l, String *w){
 	while (1){
 		if (l->cur == l->end || *l->cur == '\r' || *l->cur == '\n'){
@@ -95,13 +21,204 @@ static void advance_line(Lexer *l){
 	while (l->cur != l->end && !is_alpha_numeric(*l->cur)) l->cur++;
 }
 
-static String dictString;
+TSTRUCT(DictEntry){
+	char *word;
+	int len;
+	int type;
+	int line;
+};
+
+LIST_DEFINE(DictEntry,DictEntryList)
+
+/*
+The dictionary is a minimized acyclic automaton over the words, so the
+suffixes words share ("-ing", "-ness", "-ation") are stored once, just like
+their prefixes are. A node is two words of label mask followed by the nodes
+its set character labels lead to, in label order, so a step is a bit test
+and a popcount. The mask's low bits are the WordType of the word ending
+there. Node 0 has no labels.
+*/
+#define TYPE_MASK 511
+#define TYPE_BITS 9
+#define NO_LABEL 63//never set, for characters that can't be in a word
+#define CHAR_LABELS 36
+#define MAX_WORD_LEN 64
+
+static uint32_t *nodes;
+static int node_words, node_total;
+static uint32_t root;
+static uint32_t start[CHAR_LABELS*CHAR_LABELS];//where each two character prefix leads, the nodes near the root are the widest
+
+static int label_of(char c){
+	if (c >= '0' && c <= '9') return TYPE_BITS+c-'0';
+	if (c >= 'a' && c <= 'z') return TYPE_BITS+10+c-'a';
+	return NO_LABEL;
+}
+
+static uint64_t node_mask(uint32_t node){
+	return nodes[node] | (uint64_t)nodes[node+1] << 32;
+}
+
+static int popcount(uint64_t x){
+#ifdef _MSC_VER
+	return (int)__popcnt64(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+static uint32_t find_edge(uint32_t node, int label){
+	uint64_t mask = node_mask(node);
+	if (!(mask >> label & 1)) return 0;
+	return nodes[node+2+popcount(mask & ~(uint64_t)TYPE_MASK & (((uint64_t)1 << label)-1))];
+}
+
+static uint32_t walk(uint32_t node, char *str, int len){
+	for (int i = 0; i < len && node; i++){
+		node = find_edge(node,label_of(str[i]));
+	}
+	return node;
+}
+
+static uint32_t two_char_prefix(char *str){
+	int a = label_of(str[0]), b = label_of(str[1]);
+	if (a == NO_LABEL || b == NO_LABEL) return 0;
+	return start[(a-TYPE_BITS)*CHAR_LABELS+b-TYPE_BITS];
+}
+
+static uint32_t walk_word(char *str, int len){
+	if (len < 2) return walk(root,str,len);
+	return walk(two_char_prefix(str),str+2,len-2);
+}
+
+static int node_type(uint32_t node){
+	return nodes[node] & TYPE_MASK;
+}
+
+static int node_size(uint32_t *n){
+	return 2+popcount((n[0] | (uint64_t)n[1] << 32) & ~(uint64_t)TYPE_MASK);
+}
+
+TSTRUCT(BuildNode){
+	uint32_t words[2+64];//mask, then targets
+	int count;
+};
+
+TSTRUCT(Register){
+	uint32_t *nodes;//0 is empty
+	int total, used;
+};
+
+static uint32_t *register_slot(Register *r, uint32_t *n, int count){
+	int index = hash64((char *)n,count*sizeof(*n)) & (r->total-1);
+	while (1){
+		uint32_t *slot = r->nodes+index;
+		if (!*slot || (node_size(nodes+*slot) == count && !memcmp(nodes+*slot,n,count*sizeof(*n)))) return slot;
+		index = (index + 1) & (r->total-1);
+	}
+}
+
+static void node_clear(BuildNode *n){
+	n->words[0] = n->words[1] = 0;
+	n->count = 2;
+}
+
+//the node's labels and targets are final, returns the equivalent node already in nodes or appends it
+static uint32_t freeze(Register *r, BuildNode *n){
+	if (!n->words[0] && !n->words[1]) return 0;
+	if (2*(r->used+1) > r->total){
+		Register bigger = {zalloc_or_die(2*r->total*sizeof(*r->nodes)),2*r->total,r->used};
+		for (int i = 0; i < r->total; i++){
+			uint32_t node = r->nodes[i];
+			if (node) *register_slot(&bigger,nodes+node,node_size(nodes+node)) = node;
+		}
+		free(r->nodes);
+		*r = bigger;
+	}
+	uint32_t *slot = register_slot(r,n->words,n->count);
+	if (!*slot){
+		if (node_words > INT_MAX-n->count){
+			fatal_error("The dictionary has too many words");
+		}
+		if (node_words+n->count > node_total){
+			node_total = MAX(2*node_total,node_words+n->count);
+			nodes = realloc_or_die(nodes,node_total*sizeof(*nodes));
+		}
+		memcpy(nodes+node_words,n->words,n->count*sizeof(*nodes));
+		*slot = node_words;
+		node_words += n->count;
+		r->used++;
+	}
+	node_clear(n);
+	return *slot;
+}
+
+//its target is filled in when the node it leads to is frozen
+static void add_label(BuildNode *n, int label){
+	if (label < 32) n->words[0] |= 1u << label;
+	else n->words[1] |= 1u << (label-32);
+	n->words[n->count++] = 0;
+}
 
-static intLinkedHashList dict;
+static int compare_entries(const void *a, const void *b){
+	DictEntry *x = (DictEntry *)a, *y = (DictEntry *)b;
+	int c = memcmp(x->word,y->word,MIN(x->len,y->len));
+	if (c) return c;
+	if (x->len != y->len) return x->len - y->len;
+	return x->line - y->line;
+}
+
+/*
+Daciuk et al's incremental construction from sorted input: the nodes along
+the last word added are the only ones still changing, and each is frozen
+(replaced by an equivalent node if there is one) as soon as a later word
+branches off above it.
+*/
+static void build_automaton(DictEntryList *list){
+	if (list->used) qsort(list->elements,list->used,sizeof(*list->elements),compare_entries);
+	BuildNode *path = zalloc_or_die((MAX_WORD_LEN+1)*sizeof(*path));
+	for (int i = 0; i <= MAX_WORD_LEN; i++){
+		node_clear(path+i);
+	}
+	Register r = {zalloc_or_die(1024*sizeof(*r.nodes)),1024,0};
+	node_total = 1024;
+	nodes = zalloc_or_die(node_total*sizeof(*nodes));
+	node_words = 2;//node 0, no labels
+	DictEntry *prev = 0;
+	int depth = 0;//nodes path[0..depth] are along the last word
+	for (DictEntry *e = list->elements; e < list->elements+list->used; e++){
+		int common = 0;
+		if (prev){
+			while (common < MIN(prev->len,e->len) && prev->word[common] == e->word[common]) common++;
+			if (common == e->len && common == prev->len) continue;//the same word again, its first line wins
+		}
+		for (; depth > common; depth--){
+			path[depth-1].words[path[depth-1].count-1] = freeze(&r,path+depth);
+		}
+		for (int i = common; i < e->len; i++){
+			add_label(path+i,label_of(e->word[i]));
+		}
+		path[e->len].words[0] |= e->type;//the WordType bits are the mask's low bits
+		depth = e->len;
+		prev = e;
+	}
+	for (; depth > 0; depth--){
+		path[depth-1].words[path[depth-1].count-1] = freeze(&r,path+depth);
+	}
+	root = freeze(&r,path);
+	for (int a = 0; a < CHAR_LABELS; a++){
+		for (int b = 0; b < CHAR_LABELS; b++){
+			start[a*CHAR_LABELS+b] = find_edge(find_edge(root,TYPE_BITS+a),TYPE_BITS+b);
+		}
+	}
+	nodes = realloc_or_die(nodes,node_words*sizeof(*nodes));
+	free(r.nodes);
+	free(path);
+}
 
 void parse_dictionary_file(){
 	/*
-	Parses OxfordEnglishDictionary.txt into a hash table of word->word_type.
+	Parses OxfordEnglishDictionary.txt into an automaton of word->word_type.
 	OxfordEnglishDictionary.txt uses the following codes for word types:
 
 		NOUN, n
@@ -114,12 +231,14 @@ void parse_dictionary_file(){
 		PRONOUN, pron
 		INTERJECTION, int
 	*/
-	dictString.data = load_file("../res/OxfordEnglishDictionary.txt",&dictString.len);
+	String text;
+	text.data = load_file("../res/OxfordEnglishDictionary.txt",&text.len);
 	Lexer lexer = {
-		.prev = dictString.data,
-		.cur = dictString.data,
-		.end = dictString.data+dictString.len
+		.prev = text.data,
+		.cur = text.data,
+		.end = text.data+text.len
 	};
+	DictEntryList entries = {0};
 	while (lexer.cur != lexer.end){
 		String word,type;
 		get_word(&lexer,&word);
@@ -182,24 +301,97 @@ void parse_dictionary_file(){
 							break;
 					}
 			}
-			if (typeVal){
-				intLinkedHashListBucket *b = intLinkedHashListGetChecked(&dict,word.data,word.len);
-				if (!b){
-					b = intLinkedHashListNew(&dict,word.data,word.len);
-					b->value = typeVal;
-				}
+			if (typeVal && word.len <= MAX_WORD_LEN){
+				DictEntryListAppend(&entries,&(DictEntry){word.data,word.len,typeVal,entries.used},1);
 			}
 		}
 		advance_line(&lexer);
 	}
+	build_automaton(&entries);
+	DictEntryListFree(&entries);
+	free(text.data);
 }
 
 int get_word_type(char *str, int len){
-	intLinkedHashListBucket *b = intLinkedHashListGet(&dict,str,len);
-	if (!b){
-		return 0;
+	return node_type(walk_word(str,len));
+}
+
+void get_word_types(String *words, int count, int *types){
+	//each word's next node is prefetched while the rest of the batch take a step
+	for (int i = 0; i < count; i += WORD_TYPE_BATCH){
+		int n = MIN(WORD_TYPE_BATCH,count-i);
+		String *w = words+i;
+		uint32_t node[WORD_TYPE_BATCH];
+		int depth[WORD_TYPE_BATCH];
+		int active[WORD_TYPE_BATCH];
+		int active_count = 0;
+		for (int j = 0; j < n; j++){
+			bool two = w[j].len >= 2;
+			node[j] = two ? two_char_prefix(w[j].data) : root;
+			depth[j] = two ? 2 : 0;
+			if (node[j] && depth[j] < w[j].len){
+				PREFETCH(nodes+node[j]);
+				active[active_count++] = j;
+			} else {
+				types[i+j] = node_type(node[j]);
+			}
+		}
+		while (active_count){
+			int still = 0;
+			for (int a = 0; a < active_count; a++){
+				int j = active[a];
+				node[j] = find_edge(node[j],label_of(w[j].data[depth[j]++]));
+				if (node[j] && depth[j] < w[j].len){
+					PREFETCH(nodes+node[j]);
+					active[still++] = j;
+				} else {
+					types[i+j] = node_type(node[j]);
+				}
+			}
+			active_count = still;
+		}
 	}
-	return b->value;
+}
+
+bool is_word_prefix(char *str, int len){
+	return walk_word(str,len) != 0;
+}
+
+int get_stem_word_type(char *str, int len){
+	if (len > MAX_WORD_LEN) return 0;
+	//prefix_nodes[i] is where the first i characters lead, so every stem's walk is already done
+	uint32_t prefix_nodes[MAX_WORD_LEN+1];
+	prefix_nodes[0] = root;
+	for (int i = 0; i < len; i++){
+		prefix_nodes[i+1] = find_edge(prefix_nodes[i],label_of(str[i]));
+	}
+	int type = node_type(prefix_nodes[len]);
+	if (type) return type;
+	static char *rules[][2] = {//suffix, what it replaced
+		{"ies","y"},
+		{"ied","y"},
+		{"ing",""},
+		{"ing","e"},
+		{"ed",""},
+		{"ed","e"},
+		{"es",""},
+		{"s",""},
+	};
+	for (int i = 0; i < (int)COUNT(rules); i++){
+		int suffix_len = strlen(rules[i][0]);
+		int stem = len-suffix_len;
+		if (stem < 1 || memcmp(str+stem,rules[i][0],suffix_len)) continue;
+		type = node_type(walk(prefix_nodes[stem],rules[i][1],strlen(rules[i][1])));
+		if (!type && !rules[i][1][0] && stem >= 2 && str[stem-1] == str[stem-2]){
+			type = node_type(prefix_nodes[stem-1]);//a doubled consonant, "running"
+		}
+		if (type) return type;
+	}
+	return 0;
+}
+
+size_t dictionary_size(){
+	return node_words*sizeof(*nodes)+sizeof(start);
 }
 
 char *get_word_type_string(int type){
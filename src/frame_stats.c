@@ -0,0 +1,100 @@
+#include <frame_stats.h>
+
+#define GRAPH_BAR_WIDTH 2
+#define GRAPH_HEIGHT 60
+#define GRAPH_MAX_MS 33.3f //full graph height, two frames at 60Hz
+#define PANEL_MARGIN 8
+#define PANEL_WIDTH (FRAME_HISTORY*GRAPH_BAR_WIDTH+16)
+#define PANEL_HEIGHT (GRAPH_HEIGHT+80)
+
+void frame_stats_init(FrameStats *fs){
+	memset(fs,0,sizeof(*fs));
+	glGenQueries(GPU_QUERY_LATENCY*GPU_PASS_COUNT,fs->queries[0]);
+}
+
+void frame_stats_begin_frame(FrameStats *fs){
+	fs->frame_start = get_time();
+	fs->alloc_start = atomic_load_int(&alloc_count);
+	upload_bytes = 0;
+	if (!fs->visible) return;
+	//collect the queries issued GPU_QUERY_LATENCY frames ago before their slot gets reused
+	int slot = fs->frame % GPU_QUERY_LATENCY;
+	if (fs->issued[slot]){
+		float total = 0;
+		for (int i = 0; i < GPU_PASS_COUNT; i++){
+			GLuint available = 0;
+			glGetQueryObjectuiv(fs->queries[slot][i],GL_QUERY_RESULT_AVAILABLE,&available);
+			if (available){
+				GLuint64 ns;
+				glGetQueryObjectui64v(fs->queries[slot][i],GL_QUERY_RESULT,&ns);
+				fs->pass_ms[i] = ns/1e6f;
+			}
+			total += fs->pass_ms[i];
+		}
+		fs->gpu_ms[(fs->frame-GPU_QUERY_LATENCY+FRAME_HISTORY) % FRAME_HISTORY] = total;
+		fs->issued[slot] = false;
+	}
+}
+
+void frame_stats_begin_pass(FrameStats *fs, int pass){
+	if (fs->visible) glBeginQuery(GL_TIME_ELAPSED,fs->queries[fs->frame % GPU_QUERY_LATENCY][pass]);
+}
+
+void frame_stats_end_pass(FrameStats *fs, int pass){
+	if (fs->visible) glEndQuery(GL_TIME_ELAPSED);
+}
+
+void frame_stats_end_frame(FrameStats *fs){
+	fs->cpu_ms[fs->frame % FRAME_HISTORY] = (get_time()-fs->frame_start)*1e3;
+	fs->allocs = atomic_load_int(&alloc_count)-fs->alloc_start;//includes the pipeline worker's
+	fs->upload_bytes = upload_bytes;
+	if (fs->visible) fs->issued[fs->frame % GPU_QUERY_LATENCY] = true;
+	fs->frame++;
+}
+
+static uint32_t bar_color(float ms){
+	if (ms < 1000.0f/60) return RGBA(90,170,90,RR_FLAT);
+	if (ms < GRAPH_MAX_MS) return RGBA(200,170,60,RR_FLAT);
+	return RGBA(200,70,60,RR_FLAT);
+}
+
+void frame_stats_append_rects(FrameStats *fs, RoundedRectInstanceList *rects, int client_width, int client_height){
+	if (!fs->visible) return;
+	int left = client_width-PANEL_MARGIN-PANEL_WIDTH;
+	int bottom = client_height-PANEL_MARGIN-PANEL_HEIGHT;
+	append_rounded_rect(rects,left+PANEL_WIDTH/2,bottom+PANEL_HEIGHT/2,1,PANEL_WIDTH/2,PANEL_HEIGHT/2,8,RGBA(40,40,40,RR_FLAT),RGBA(0,0,0,RR_ICON_NONE));
+	//oldest frame on the left, cpu bars with the gpu time as a narrower bar in front
+	int graph_left = left+8;
+	int graph_bottom = bottom+8;
+	for (int i = 0; i < FRAME_HISTORY; i++){
+		int index = (fs->frame+i) % FRAME_HISTORY;
+		int x = graph_left+i*GRAPH_BAR_WIDTH+GRAPH_BAR_WIDTH/2;
+		int cpu_height = MAX(1,(int)(MIN(fs->cpu_ms[index],GRAPH_MAX_MS)/GRAPH_MAX_MS*GRAPH_HEIGHT/2));
+		append_rounded_rect(rects,x,graph_bottom+cpu_height,2,GRAPH_BAR_WIDTH/2,cpu_height,1,bar_color(fs->cpu_ms[index]),RGBA(0,0,0,RR_ICON_NONE));
+		if (fs->gpu_ms[index] > 0){
+			int gpu_height = MAX(1,(int)(MIN(fs->gpu_ms[index],GRAPH_MAX_MS)/GRAPH_MAX_MS*GRAPH_HEIGHT/2));
+			append_rounded_rect(rects,x,graph_bottom+gpu_height,3,1,gpu_height,1,RGBA(90,140,220,RR_FLAT),RGBA(0,0,0,RR_ICON_NONE));
+		}
+	}
+}
+
+void frame_stats_append_text(FrameStats *fs, TextureColorVertexList *verts, SDFFont *font, int client_width, int client_height){
+	if (!fs->visible) return;
+	float cpu_avg = 0, cpu_max = 0;
+	for (int i = 0; i < FRAME_HISTORY; i++){
+		cpu_avg += fs->cpu_ms[i];
+		cpu_max = MAX(cpu_max,fs->cpu_ms[i]);
+	}
+	cpu_avg /= FRAME_HISTORY;
+	char lines[4][96];
+	snprintf(lines[0],COUNT(lines[0]),"cpu %.2f ms (avg %.2f, max %.2f)",fs->cpu_ms[(fs->frame+FRAME_HISTORY-1) % FRAME_HISTORY],cpu_avg,cpu_max);
+	snprintf(lines[1],COUNT(lines[1]),"gpu img %.2f btn %.2f txt %.2f ms",fs->pass_ms[GPU_PASS_IMAGES],fs->pass_ms[GPU_PASS_BUTTONS],fs->pass_ms[GPU_PASS_TEXT]);
+	snprintf(lines[2],COUNT(lines[2]),"uploads %.1f KB",fs->upload_bytes/1024.0);
+	snprintf(lines[3],COUNT(lines[3]),"allocations %d",fs->allocs);
+	float x = client_width-PANEL_MARGIN-PANEL_WIDTH+8;
+	float y = client_height-PANEL_MARGIN-20;
+	for (int i = 0; i < COUNT(lines); i++){
+		append_sdf_string(verts,font,x,y,4,12,RGBA(255,255,255,255),strlen(lines[i]),lines[i]);
+		y -= 16;
+	}
+}
\ No newline at end of file
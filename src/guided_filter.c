@@ -0,0 +1,179 @@
+#include <guided_filter.h>
+
+#define BOX_MAX_CHANNELS 6 //a pair of values for each of RGB, or 2 for grey
+
+/*
+BoxStream
+Box filter over a stream of rows of n floats per pixel, pulled from source
+in order. Windows are clamped to the image, so border pixels average over
+fewer rows and columns rather than repeating the edge. ring holds the
+horizontal window sums of the rows in the vertical window and column their
+sum, so each output row costs one row entering and one leaving.
+*/
+TSTRUCT(BoxStream){
+	int width, height, n, r;
+	void (*source)(void *ctx, int y, float *row);
+	void *ctx;
+	float *in;
+	float *ring;
+	double *column;
+	int ring_rows;
+	int next_in, next_out;
+};
+
+static void box_stream_init(BoxStream *s, int width, int height, int n, int r, void (*source)(void *ctx, int y, float *row), void *ctx){
+	Arena *scratch = scratch_arena();
+	s->width = width;
+	s->height = height;
+	s->n = n;
+	s->r = r;
+	s->source = source;
+	s->ctx = ctx;
+	s->ring_rows = MIN(2*r+1,height);
+	s->in = arena_alloc(scratch,(size_t)width*n*sizeof(*s->in));
+	s->ring = arena_alloc(scratch,(size_t)s->ring_rows*width*n*sizeof(*s->ring));
+	s->column = arena_alloc(scratch,(size_t)width*n*sizeof(*s->column));
+	memset(s->column,0,(size_t)width*n*sizeof(*s->column));
+	s->next_in = 0;
+	s->next_out = 0;
+}
+
+//window sums clamped to the row, n is a constant at each call so the channel loops unroll
+static inline void horizontal_sums(float *dst, float *src, int width, int n, int r){
+	float sums[BOX_MAX_CHANNELS] = {0};
+	int x = 0;
+	for (; x < MIN(r,width); x++){
+		for (int c = 0; c < n; c++) sums[c] += src[x*n+c];
+	}
+	for (x = 0; x < width; x++){
+		if (x+r < width){
+			for (int c = 0; c < n; c++) sums[c] += src[(x+r)*n+c];
+		}
+		if (x-r-1 >= 0){
+			for (int c = 0; c < n; c++) sums[c] -= src[(x-r-1)*n+c];
+		}
+		for (int c = 0; c < n; c++) dst[x*n+c] = sums[c];
+	}
+}
+
+//writes the window means of the next row
+static void box_stream_next(BoxStream *s, float *out){
+	int y = s->next_out++;
+	int n = s->n, row_len = s->width*n;
+	//the row leaving goes first, the one entering takes its slot in the ring
+	if (y-s->r-1 >= 0){
+		float *old = s->ring+(size_t)((y-s->r-1)%s->ring_rows)*row_len;
+		for (int i = 0; i < row_len; i++) s->column[i] -= old[i];
+	}
+	int hi = MIN(s->height-1,y+s->r);
+	while (s->next_in <= hi){
+		float *sums = s->ring+(size_t)(s->next_in%s->ring_rows)*row_len;
+		s->source(s->ctx,s->next_in,s->in);
+		if (n == 2) horizontal_sums(sums,s->in,s->width,2,s->r);
+		else horizontal_sums(sums,s->in,s->width,6,s->r);
+		for (int i = 0; i < row_len; i++) s->column[i] += sums[i];
+		s->next_in++;
+	}
+	double inv_rows = 1.0/(hi-MAX(0,y-s->r)+1);
+	for (int x = 0; x < s->width; x++){
+		double inv = inv_rows/(MIN(s->width-1,x+s->r)-MAX(0,x-s->r)+1);
+		for (int c = 0; c < n; c++) out[x*n+c] = s->column[x*n+c]*inv;
+	}
+}
+
+TSTRUCT(GuidedFilter){
+	BoxStream moments;//window means of I and I^2 for each channel
+	BoxStream coefficients;//window means of a and b for each channel
+	float *means;
+	void *img;
+};
+
+static void coefficient_row(void *ctx, int y, float *row){
+	GuidedFilter *g = ctx;
+	box_stream_next(&g->moments,g->means);
+	for (int i = 0; i < g->moments.width*g->moments.n; i += 2){
+		float mean = g->means[i];
+		float variance = MAX(0.0f,g->means[i+1]-mean*mean);
+		float a = variance/(variance+GUIDED_FILTER_EPSILON);
+		row[i] = a;
+		row[i+1] = mean-a*mean;
+	}
+}
+
+static void guided_filter_init(GuidedFilter *g, void *img, int width, int height, int channels, int radius, void (*moments_row)(void *ctx, int y, float *row)){
+	g->img = img;
+	g->means = arena_alloc(scratch_arena(),(size_t)width*channels*2*sizeof(*g->means));
+	box_stream_init(&g->moments,width,height,channels*2,radius,moments_row,img);
+	box_stream_init(&g->coefficients,width,height,channels*2,radius,coefficient_row,g);
+}
+
+static void rgba_moments_row(void *ctx, int y, float *row){
+	uint8_t *p = (uint8_t *)image_row(ctx,y);
+	for (int x = 0; x < ((Image *)ctx)->width; x++){
+		for (int c = 0; c < 3; c++){
+			float v = p[x*4+c]/255.0f;
+			row[x*6+c*2] = v;
+			row[x*6+c*2+1] = v*v;
+		}
+	}
+}
+
+static void grey_moments_row(void *ctx, int y, float *row){
+	uint8_t *p = image8_row(ctx,y);
+	for (int x = 0; x < ((Image8 *)ctx)->width; x++){
+		float v = p[x]/255.0f;
+		row[x*2] = v;
+		row[x*2+1] = v*v;
+	}
+}
+
+static uint8_t fit(float *ab, uint8_t v){
+	return CLAMP((int)((ab[0]*(v/255.0f)+ab[1])*255.0f+0.5f),0,255);
+}
+
+//row y is only written after the moments stream has read every row it needs from it, which is what lets this run in place
+static void guided_pass(Image *img, int radius){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	GuidedFilter g;
+	guided_filter_init(&g,img,img->width,img->height,3,radius,rgba_moments_row);
+	float *ab = arena_alloc(scratch,(size_t)img->width*6*sizeof(*ab));
+	for (int y = 0; y < img->height; y++){
+		box_stream_next(&g.coefficients,ab);
+		uint8_t *p = (uint8_t *)image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			for (int c = 0; c < 3; c++){
+				p[x*4+c] = fit(ab+x*6+c*2,p[x*4+c]);
+			}
+		}
+	}
+	arena_release(scratch,mark);
+}
+
+static void guided_pass8(Image8 *img, int radius){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	GuidedFilter g;
+	guided_filter_init(&g,img,img->width,img->height,1,radius,grey_moments_row);
+	float *ab = arena_alloc(scratch,(size_t)img->width*2*sizeof(*ab));
+	for (int y = 0; y < img->height; y++){
+		box_stream_next(&g.coefficients,ab);
+		uint8_t *p = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			p[x] = fit(ab+x*2,p[x]);
+		}
+	}
+	arena_release(scratch,mark);
+}
+
+void img_guided_filter(Image *img, int radius){
+	for (int i = 0; i < GUIDED_FILTER_PASSES; i++){
+		guided_pass(img,radius);
+	}
+}
+
+void img8_guided_filter(Image8 *img, int radius){
+	for (int i = 0; i < GUIDED_FILTER_PASSES; i++){
+		guided_pass8(img,radius);
+	}
+}
\ No newline at end of file
@@ -1,4 +1,145 @@
 #include <image.h>
+#include <trace.h>
+
+static int aligned_stride(int width, int bytes_per_pixel){
+	int row = (width*bytes_per_pixel+IMAGE_ROW_ALIGN-1) & ~(IMAGE_ROW_ALIGN-1);
+	return row/bytes_per_pixel;
+}
+
+size_t memory_budget = DEFAULT_MEMORY_BUDGET;
+char *scratch_dir;
+
+#define MAX_MAPPED_IMAGES 256
+
+TSTRUCT(MappedRegion){
+	uint8_t *base;
+	size_t size;
+};
+
+//every live scratch mapping, so image_free and eviction can tell them from heap pixels
+static MappedRegion mapped[MAX_MAPPED_IMAGES];
+static int mapped_count;
+static volatile int mapped_lock;
+
+static void lock_mapped(){
+	while (atomic_exchange_int(&mapped_lock,1));
+}
+
+static void unlock_mapped(){
+	atomic_store_int(&mapped_lock,0);
+}
+
+bool image_out_of_core(int width, int height, int bytes_per_pixel){
+	return (size_t)width*height*bytes_per_pixel > memory_budget/IMAGE_BUDGET_SHARE;
+}
+
+static void *pixels_alloc(size_t size, bool out_of_core){
+	if (!out_of_core) return aligned_alloc_or_die(IMAGE_ROW_ALIGN,size);
+	uint8_t *p = map_scratch_file(scratch_dir,size);//page aligned, so row aligned too
+	if (!p) fatal_error("Failed to map a %zu byte scratch file in %s",size,scratch_dir ? scratch_dir : "the temp directory");
+	lock_mapped();
+	if (mapped_count == MAX_MAPPED_IMAGES) fatal_error("Too many out-of-core images");
+	mapped[mapped_count].base = p;
+	mapped[mapped_count].size = size;
+	mapped_count++;
+	unlock_mapped();
+	return p;
+}
+
+static void pixels_free(void *pixels){
+	if (!pixels) return;
+	lock_mapped();
+	for (int i = 0; i < mapped_count; i++){
+		if (mapped[i].base == pixels){
+			MappedRegion r = mapped[i];
+			mapped[i] = mapped[--mapped_count];
+			unlock_mapped();
+			unmap_scratch_file(r.base,r.size);
+			return;
+		}
+	}
+	unlock_mapped();
+	aligned_free(pixels);
+}
+
+static void evict(uint8_t *start, uint8_t *end){
+	lock_mapped();
+	for (int i = 0; i < mapped_count; i++){
+		if (start >= mapped[i].base && end <= mapped[i].base+mapped[i].size){
+			unlock_mapped();
+			evict_pages(start,end-start);
+			return;
+		}
+	}
+	unlock_mapped();
+}
+
+void image_evict_rows(Image *img, int y0, int y1){
+	if (y1 > y0) evict((uint8_t *)image_row(img,y0),(uint8_t *)(image_row(img,y1-1)+img->width));
+}
+
+void image8_evict_rows(Image8 *img, int y0, int y1){
+	if (y1 > y0) evict(image8_row(img,y0),image8_row(img,y1-1)+img->width);
+}
+
+void image_alloc(Image *img, int width, int height){
+	img->width = width;
+	img->height = height;
+	img->stride = aligned_stride(width,sizeof(*img->pixels));
+	img->pixels = pixels_alloc((size_t)img->stride*height*sizeof(*img->pixels),image_out_of_core(width,height,sizeof(*img->pixels)));
+}
+
+void image8_alloc(Image8 *img, int width, int height){
+	img->width = width;
+	img->height = height;
+	img->stride = aligned_stride(width,1);
+	img->pixels = pixels_alloc((size_t)img->stride*height,image_out_of_core(width,height,1));
+}
+
+void image_free(Image *img){
+	pixels_free(img->pixels);
+	img->pixels = 0;
+}
+
+void image8_free(Image8 *img){
+	pixels_free(img->pixels);
+	img->pixels = 0;
+}
+
+Image image_view(Image *img, int x, int y, int width, int height){
+	Image v = {width,height,img->stride,image_row(img,y)+x};
+	return v;
+}
+
+Image8 image8_view(Image8 *img, int x, int y, int width, int height){
+	Image8 v = {width,height,img->stride,image8_row(img,y)+x};
+	return v;
+}
+
+void image_copy(Image *dst, Image *src){
+	//rows are copied separately since a view's padding belongs to its parent
+	for (int y = 0; y < src->height; y++){
+		memcpy(image_row(dst,y),image_row(src,y),(size_t)src->width*sizeof(*src->pixels));
+	}
+}
+
+void image8_copy(Image8 *dst, Image8 *src){
+	for (int y = 0; y < src->height; y++){
+		memcpy(image8_row(dst,y),image8_row(src,y),src->width);
+	}
+}
+
+void image_clear(Image *img){
+	for (int y = 0; y < img->height; y++){
+		memset(image_row(img,y),0,(size_t)img->width*sizeof(*img->pixels));
+	}
+}
+
+void image8_clear(Image8 *img){
+	for (int y = 0; y < img->height; y++){
+		memset(image8_row(img,y),0,img->width);
+	}
+}
 
 static void load_jpeg(Image *img, char *path){
 	FILE *file = fopen(path,"rb");
@@ -15,17 +156,16 @@ static void load_jpeg(Image *img, char *path){
 	jpeg_read_header(&info,TRUE);
 	jpeg_start_decompress(&info);
 
-	img->width = info.output_width;
-	img->height = info.output_height;
-	img->pixels = malloc_or_die(img->width*img->height*sizeof(*img->pixels));
+	image_alloc(img,info.output_width,info.output_height);
 	switch (info.num_components){
 	case 1:{
 		uint8_t *temp = malloc_or_die(img->width);
 		for (int y = 0; y < img->height; y++){
 			jpeg_read_scanlines(&info,&temp,1);
+			uint32_t *row = image_row(img,y);
 			for (int x = 0; x < img->width; x++){
 				uint8_t t = temp[x];
-				img->pixels[y*img->width+x] = RGBA(t,t,t,255);
+				row[x] = RGBA(t,t,t,255);
 			}
 		}
 		free(temp);
@@ -35,9 +175,10 @@ static void load_jpeg(Image *img, char *path){
 		uint8_t *temp = malloc_or_die(img->width*3);
 		for (int y = 0; y < img->height; y++){
 			jpeg_read_scanlines(&info,&temp,1);
+			uint32_t *row = image_row(img,y);
 			for (int x = 0; x < img->width; x++){
 				uint8_t *t = temp+x*3;
-				img->pixels[y*img->width+x] = RGBA(t[0],t[1],t[2],255);
+				row[x] = RGBA(t[0],t[1],t[2],255);
 			}
 		}
 		free(temp);
@@ -61,16 +202,13 @@ static void load_png(Image *img, char *path){
 		fatal_error("texture_from_file: failed to load %s",path);
 	}
 	image.format = PNG_FORMAT_RGBA;
-	png_byte *buffer = malloc_or_die(PNG_IMAGE_SIZE(image));
+	image_alloc(img,image.width,image.height);
 	// a negative stride indicates that the bottom-most row is first in the buffer
 	// (as expected by openGL)
-	if (!png_image_finish_read(&image, NULL, buffer, -image.width*4, NULL)) {
+	if (!png_image_finish_read(&image, NULL, img->pixels, -img->stride*4, NULL)) {
 		png_image_free(&image);
 		fatal_error("texture_from_file: failed to load %s",path);
 	}
-	img->width = image.width;
-	img->height = image.height;
-	img->pixels = buffer;
 }
 
 void load_image(Image *img, char *path){
@@ -78,11 +216,25 @@ void load_image(Image *img, char *path){
 	if (len < 5){
 		fatal_error("texture_from_file: invalid path: %s",path);
 	}
+	double t = trace_begin();
 	if (!memcmp(path+len-4,".jpg",4)){
 		load_jpeg(img,path);
+		trace_end("load_jpeg",t);
 	} else if (!memcmp(path+len-4,".png",4)){
 		load_png(img,path);
+		trace_end("load_png",t);
 	} else {
 		fatal_error("texture_from_file: invalid file extension: %s. Expected .png/.jpg");
 	}
+}
+
+void save_png(Image *img, char *path){
+	png_image image = {0};
+	image.version = PNG_IMAGE_VERSION;
+	image.width = img->width;
+	image.height = img->height;
+	image.format = PNG_FORMAT_RGBA;
+	if (!png_image_write_to_file(&image,path,0,img->pixels,img->stride*4,NULL)){
+		fatal_error("save_png: failed to write %s: %s",path,image.message);
+	}
 }
\ No newline at end of file
@@ -1,48 +1,31 @@
 #include "image_effects.h"
 
-ColorRect *ColorRectListMakeRoom(ColorRectList *list, int count){
-	if (list->used+count > list->total){
-		if (!list->total) list->total = 1;
-		while (list->used+count > list->total) list->total *= 2;
-		list->elements = realloc_or_die(list->elements,list->total*sizeof(*list->elements));
-	}
-	list->used += count;
-	return list->elements+list->used-count;
-}
-
-ivec2 *ivec2ListMakeRoom(ivec2List *list, int count){
-	if (list->used+count > list->total){
-		if (!list->total) list->total = 1;
-		while (list->used+count > list->total) list->total *= 2;
-		list->elements = realloc_or_die(list->elements,list->total*sizeof(*list->elements));
-	}
-	list->used += count;
-	return list->elements+list->used-count;
-}
-
-void ivec2ListAppend(ivec2List *list, ivec2 *elements, int count){
-	memcpy(ivec2ListMakeRoom(list,count),elements,count*sizeof(*elements));
-}
-
 void img_alpha255(Image *img){
-	for (int i = 0; i < img->width*img->height; i++){
-		uint8_t *p = img->pixels+i;
-		p[3] = 255;
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = (uint8_t *)image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			row[x*4+3] = 255;
+		}
 	}
 }
 
 void img_greyscale(Image *img){
-	for (int i = 0; i < img->width*img->height; i++){
-		uint8_t *p = img->pixels+i;
-		uint8_t grey = MIN(255,0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]);
-		p[0] = grey;
-		p[1] = grey;
-		p[2] = grey;
+	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			uint8_t *p = (uint8_t *)(row+x);
+			uint8_t grey = MIN(255,0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]);
+			p[0] = grey;
+			p[1] = grey;
+			p[2] = grey;
+		}
 	}
 }
 
 void img_gaussian_blur(Image *img, int strength){
-	float *kernel = malloc_or_die(strength*sizeof(*kernel));
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	float *kernel = arena_alloc(scratch,strength*sizeof(*kernel));
 	float disx = 0.0f;
 	for (int i = 0; i < strength; i++){
 		kernel[i] = expf(-0.5f*disx*disx)/sqrtf(2.0f*M_PI); //This is the gaussian distribution with mean=0, standard_deviation=1
@@ -58,55 +41,63 @@ void img_gaussian_blur(Image *img, int strength){
 	Image b;
 	b.width = img->width;
 	b.height = img->height;
-	b.pixels = malloc_or_die(b.width*b.height*sizeof(*b.pixels));
+	b.stride = img->width;
+	b.pixels = arena_alloc(scratch,(size_t)b.width*b.height*sizeof(*b.pixels));
 	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
 		for (int x = 0; x < img->width; x++){
 			float sums[3] = {0,0,0};
 			for (int dx = -strength+1; dx < strength-1; dx++){
-				uint8_t *p = img->pixels+y*img->width+CLAMP(x+dx,0,img->width-1);
+				uint8_t *p = (uint8_t *)(row+CLAMP(x+dx,0,img->width-1));
 				for (int i = 0; i < 3; i++){
 					sums[i] = MIN(1.0f,sums[i]+(p[i]/255.0f)*kernel[abs(dx)]);
 				}
 			}
-			uint8_t *p = b.pixels+y*b.width+x;
+			uint8_t *p = (uint8_t *)(image_row(&b,y)+x);
 			for (int i = 0; i < 3; i++){
 				p[i] = sums[i]*255;
 			}
-			p[3] = ((uint8_t *)(img->pixels+y*img->width+x))[3];
+			p[3] = ((uint8_t *)(row+x))[3];
 		}
 	}
 	for (int x = 0; x < img->width; x++){
 		for (int y = 0; y < img->height; y++){
 			float sums[3] = {0,0,0};
 			for (int dy = -strength+1; dy < strength-1; dy++){
-				uint8_t *p = b.pixels+CLAMP(y+dy,0,b.height-1)*b.width+x;
+				uint8_t *p = (uint8_t *)(image_row(&b,CLAMP(y+dy,0,b.height-1))+x);
 				for (int i = 0; i < 3; i++){
 					sums[i] = MIN(1.0f,sums[i]+(p[i]/255.0f)*kernel[abs(dy)]);
 				}
 			}
-			uint8_t *p = img->pixels+y*img->width+x;
+			uint8_t *p = (uint8_t *)(image_row(img,y)+x);
 			for (int i = 0; i < 3; i++){
 				p[i] = sums[i]*255;
 			}
-			p[3] = ((uint8_t *)(b.pixels+y*b.width+x))[3];
+			p[3] = ((uint8_t *)(image_row(&b,y)+x))[3];
 		}
 	}
-	free(kernel);
-	free(b.pixels);
+	arena_release(scratch,mark);
 }
 
-void img_quantize(Image *img, int divisions){
-	int mins[3] = {255,255,255};
-	int maxes[3] = {0,0,0};
-	for (int i = 0; i < img->width*img->height; i++){
-		uint8_t *p = img->pixels+i;
-		for (int j = 0; j < 3; j++){
-			if (p[j] < mins[j]) mins[j] = p[j];
-			else if (p[j] > maxes[j]) maxes[j] = p[j];
+void img_channel_range(Image *img, int mins[3], int maxes[3]){
+	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			uint8_t *p = (uint8_t *)(row+x);
+			for (int j = 0; j < 3; j++){
+				if (p[j] < mins[j]) mins[j] = p[j];
+				else if (p[j] > maxes[j]) maxes[j] = p[j];
+			}
 		}
 	}
-	int *invals = malloc_or_die(divisions*3*sizeof(*invals));
-	int *outvals = malloc_or_die(divisions*sizeof(*invals));
+}
+
+void img_quantize_range(Image *img, int divisions, int range_mins[3], int maxes[3]){
+	int mins[3] = {range_mins[0],range_mins[1],range_mins[2]};
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	int *invals = arena_alloc(scratch,divisions*3*sizeof(*invals));
+	int *outvals = arena_alloc(scratch,divisions*sizeof(*invals));
 	int ids[3];
 	for (int i = 0; i < 3; i++){
 		ids[i] = (maxes[i]-mins[i])/divisions;
@@ -128,71 +119,544 @@ void img_quantize(Image *img, int divisions){
 	}
 	outvals[divisions-1] = 255;
 
-	for (int i = 0; i < img->width*img->height; i++){
-		uint8_t *p = img->pixels+i;
-		for (int j = 0; j < 3; j++){
-			for (int k = 1; k < divisions; k++){
-				if (p[j] <= invals[j*divisions+k]){
-					if (p[j]-invals[j*divisions+k-1] > invals[j*divisions+k]-p[j]){
-						p[j] = outvals[k];
-					} else {
-						p[j] = outvals[k-1];
+	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			uint8_t *p = (uint8_t *)(row+x);
+			for (int j = 0; j < 3; j++){
+				for (int k = 1; k < divisions; k++){
+					if (p[j] <= invals[j*divisions+k]){
+						if (p[j]-invals[j*divisions+k-1] > invals[j*divisions+k]-p[j]){
+							p[j] = outvals[k];
+						} else {
+							p[j] = outvals[k-1];
+						}
+						break;
 					}
-					break;
 				}
 			}
 		}
 	}
-	free(invals);
-	free(outvals);
+	arena_release(scratch,mark);
 }
 
-void img_rect_decompose(Image *img, ColorRectList *crl, int min_dim){
-	img_alpha255(img);//force max alpha for image because rect_decompose relies on 0-value pixels
+void img_quantize(Image *img, int divisions){
+	int mins[3] = {255,255,255};
+	int maxes[3] = {0,0,0};
+	img_channel_range(img,mins,maxes);
+	img_quantize_range(img,divisions,mins,maxes);
+}
+
+void img_unpremultiply(Image *img){
 	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
 		for (int x = 0; x < img->width; x++){
-			uint32_t c = img->pixels[y*img->width+x];
-			if (c){
-				int i, j;
-				int lim = img->width;
-				for (j = y; j < img->height; j++){
-					for (i = x; i < lim; i++){
-						if (img->pixels[j*img->width+i] != c){
-							if (lim != img->width && i!=lim){
-								i = lim;
-								goto L0;
-							} else {
-								lim = i;
-							}
-						}
+			uint8_t *p = (uint8_t *)(row+x);
+			if (p[3] && p[3] != 255){
+				for (int j = 0; j < 3; j++){
+					p[j] = MIN(255,(p[j]*255+p[3]/2)/p[3]);
+				}
+			}
+		}
+	}
+}
+
+void img_half(Image *dst, Image *src){
+	image_alloc(dst,MAX(1,src->width/2),MAX(1,src->height/2));
+	img_half_into(dst,src);
+}
+
+void img_half_into(Image *dst, Image *src){
+	for (int y = 0; y < dst->height; y++){
+		uint8_t *r0 = (uint8_t *)image_row(src,MIN(y*2,src->height-1));
+		uint8_t *r1 = (uint8_t *)image_row(src,MIN(y*2+1,src->height-1));
+		uint8_t *d = (uint8_t *)image_row(dst,y);
+		for (int x = 0; x < dst->width; x++){
+			size_t x0 = (size_t)MIN(x*2,src->width-1)*4;
+			size_t x1 = (size_t)MIN(x*2+1,src->width-1)*4;
+			for (int i = 0; i < 4; i++){
+				d[(size_t)x*4+i] = (r0[x0+i]+r0[x1+i]+r1[x0+i]+r1[x1+i]+2)/4;
+			}
+		}
+	}
+}
+
+static void fill_rect(Image *img, int x, int y, int width, int height, uint32_t color){
+	for (int j = y; j < y+height; j++){
+		uint32_t *p = image_row(img,j)+x;
+		int i = 0;
+#ifdef COLOR_RECTS_SSE2
+		__m128i c = _mm_set1_epi32(color);
+		for (; i+4 <= width; i += 4){
+			_mm_storeu_si128((__m128i *)(p+i),c);
+		}
+#endif
+		for (; i < width; i++){
+			p[i] = color;
+		}
+	}
+}
+
+/*
+Greedy raster scan: each pixel not yet in a rectangle grows one right along
+its row and then down while the rows match. With seam_above/seam_below,
+rectangles touching img's top/bottom edge need only one row instead of
+min_dim, so a stripe keeps the pieces a seam cut short for merge_stripes
+to join.
+The scans keep a run per pixel, how many pixels from it rightwards along
+its row have its color and aren't in a rectangle yet (0 once taken), so
+checking a row under a growing rectangle is one lookup rather than a walk
+across its width.
+*/
+static void row_runs(uint16_t *runs, uint32_t *row, int width){
+	runs[width-1] = 1;
+	for (int x = width-2; x >= 0; x--){
+		runs[x] = row[x] == row[x+1] ? runs[x+1]+1 : 1;
+	}
+}
+
+static void row_runs8(uint16_t *runs, uint8_t *row, int width){
+	runs[width-1] = 1;
+	for (int x = width-2; x >= 0; x--){
+		runs[x] = row[x] == row[x+1] ? runs[x+1]+1 : 1;
+	}
+}
+
+//marks the rectangle taken and cuts the runs that reached into it from the left
+static void take_rect(uint16_t *runs, size_t runs_stride, int x, int y, int width, int height){
+	for (int b = y; b < y+height; b++){
+		uint16_t *r = runs+b*runs_stride;
+		memset(r+x,0,width*sizeof(*r));
+		for (int k = x-1; k >= 0 && r[k] > x-k; k--){
+			r[k] = x-k;
+		}
+	}
+}
+
+static void rect_scan(Image *img, uint16_t *runs, size_t runs_stride, ColorRects *rects, int min_dim, bool seam_above, bool seam_below){
+	for (int y = 0; y < img->height; y++){
+		row_runs(runs+y*runs_stride,image_row(img,y),img->width);
+	}
+	for (int y = 0; y < img->height; y++){
+		for (int x = 0; x < img->width; x++){
+			if (!runs[y*runs_stride+x]) continue;
+			uint32_t c = image_row(img,y)[x];
+			int j;
+			int lim = img->width;
+			int stop = x;
+			for (j = y; j < img->height; j++){
+				int end = image_row(img,j)[x] == c ? x+runs[j*runs_stride+x] : x;//first pixel from x on that isn't c or is taken
+				if (end < lim){
+					if (lim != img->width){
+						stop = end;
+						break;
 					}
+					lim = end;//only the first row or one reaching the image's right edge sets the width, other rows stop the rectangle
 				}
-			L0:;
-				int width = i-x;
-				int height = j-y;
-				if (width >= min_dim && height >= min_dim){
-					ColorRect *r = ColorRectListMakeRoom(crl,1);
-					r->left = x;
-					r->right = i;
-					r->top = y;
-					r->bottom = j;
-					r->color = c;
-					for (int b = y; b < j; b++){
-						for (int a = x; a < i; a++){
-							img->pixels[b*img->width+a] = 0;
-						}
+				if (lim-x < min_dim) break;//too narrow already, lim only shrinks
+			}
+			int width = lim-x;
+			int height = j-y;
+			bool seam = (seam_above && y == 0) || (seam_below && j == img->height);
+			if (width >= min_dim && height >= (seam ? 1 : min_dim)){
+				color_rects_append(rects,x,y,width,height,c);
+				take_rect(runs,runs_stride,x,y,width,height);
+			} else {
+				x = stop;//the pixels up to the one that stopped this rectangle would stop at the same row
+			}
+		}
+	}
+}
+
+//paints the rectangles from first on, colors come from their own stream so they depend only on the seed, the stream and the rectangles, not on what ran before on this thread
+static void fill_random(Image *img, ColorRects *rects, int first, uint64_t stream){
+	Rng rng;
+	rng_seed(&rng,random_seed,stream);
+	image_clear(img);
+	for (int i = first; i < rects->used; i++){
+		uint32_t c = rng_next(&rng) >> 40;//24 random bits
+		fill_rect(img,color_rects_get_x(rects,i),color_rects_get_y(rects,i),rects->width[i],rects->height[i],c | 0xff000000);
+	}
+}
+
+/*
+Decomposes each tile of at most COLOR_RECT_MAX_DIM a side on its own with
+stream plus its index and appends its rectangles to rects moved to the
+tile's origin. img is painted, from img8's rectangles if it's given.
+*/
+static void decompose_tiles(Image *img, Image8 *img8, ColorRects *rects, int min_dim, uint64_t stream, bool parallel, Cancel *cancel){
+	int width = img->width;
+	int height = img->height;
+	ColorRects tile_rects = {0};
+	uint64_t tile_stream = stream;
+	for (int y0 = 0; y0 < height; y0 += COLOR_RECT_MAX_DIM){
+		for (int x0 = 0; x0 < width; x0 += COLOR_RECT_MAX_DIM){
+			if (cancelled(cancel)) break;
+			int w = MIN(COLOR_RECT_MAX_DIM,width-x0), h = MIN(COLOR_RECT_MAX_DIM,height-y0);
+			ColorRects *r = &tile_rects;
+			color_rects_clear(r);
+			Image tile = image_view(img,x0,y0,w,h);
+			if (img8){
+				Image8 src = image8_view(img8,x0,y0,w,h);
+				if (parallel) img8_rect_decompose_parallel(&src,&tile,r,min_dim,tile_stream++,cancel);
+				else img8_rect_decompose(&src,&tile,r,min_dim,tile_stream++);
+			} else {
+				if (parallel) img_rect_decompose_parallel(&tile,r,min_dim,tile_stream++,cancel);
+				else img_rect_decompose(&tile,r,min_dim,tile_stream++);
+			}
+			color_rects_append_moved(rects,r,x0,y0);
+		}
+	}
+	color_rects_free(&tile_rects);
+}
+
+void img_rect_decompose(Image *img, ColorRects *rects, int min_dim, uint64_t stream){
+	if (img->width > COLOR_RECT_MAX_DIM || img->height > COLOR_RECT_MAX_DIM){
+		decompose_tiles(img,0,rects,min_dim,stream,false,0);
+		return;
+	}
+	int first = rects->used;
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	uint16_t *runs = arena_alloc(scratch,(size_t)img->width*img->height*sizeof(*runs));
+	img_alpha255(img);//rectangle colors are opaque
+	rect_scan(img,runs,img->width,rects,min_dim,false,false);
+	fill_random(img,rects,first,stream);
+	arena_release(scratch,mark);
+}
+
+void img_to_grey8(Image8 *dst, Image *src){
+	for (int y = 0; y < src->height; y++){
+		uint32_t *row = image_row(src,y);
+		uint8_t *d = image8_row(dst,y);
+		for (int x = 0; x < src->width; x++){
+			uint8_t *p = (uint8_t *)(row+x);
+			d[x] = MIN(255,0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]);
+		}
+	}
+}
+
+void img8_gaussian_blur(Image8 *img, int strength){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	float *kernel = arena_alloc(scratch,strength*sizeof(*kernel));
+	float disx = 0.0f;
+	for (int i = 0; i < strength; i++){
+		kernel[i] = expf(-0.5f*disx*disx)/sqrtf(2.0f*M_PI);
+		disx += 3.0f / (strength-1);
+	}
+	float sum = 0.0f;
+	for (int i = 0; i < strength; i++){
+		sum += (i ? 2 : 1) * kernel[i];
+	}
+	for (int i = 0; i < strength; i++){
+		kernel[i] /= sum;
+	}
+	uint8_t *b = arena_alloc(scratch,(size_t)img->width*img->height);
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			float s = 0;
+			for (int dx = -strength+1; dx < strength-1; dx++){
+				s = MIN(1.0f,s+(row[CLAMP(x+dx,0,img->width-1)]/255.0f)*kernel[abs(dx)]);
+			}
+			b[(size_t)y*img->width+x] = s*255;
+		}
+	}
+	for (int x = 0; x < img->width; x++){
+		for (int y = 0; y < img->height; y++){
+			float s = 0;
+			for (int dy = -strength+1; dy < strength-1; dy++){
+				s = MIN(1.0f,s+(b[(size_t)CLAMP(y+dy,0,img->height-1)*img->width+x]/255.0f)*kernel[abs(dy)]);
+			}
+			image8_row(img,y)[x] = s*255;
+		}
+	}
+	arena_release(scratch,mark);
+}
+
+void img8_range(Image8 *img, int *min, int *max){
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			if (row[x] < *min) *min = row[x];
+			else if (row[x] > *max) *max = row[x];
+		}
+	}
+}
+
+void img8_quantize_range(Image8 *img, int divisions, int min, int max){
+	//same thresholds as img_quantize, applied through a 256 entry table
+	int invals[256], outvals[256];
+	int id = (max-min)/divisions;
+	int od = 255/divisions;
+	for (int j = 0; j < divisions; j++){
+		invals[j] = min+j*id;
+		outvals[j] = j*od;
+	}
+	invals[divisions-1] = max;
+	outvals[divisions-1] = 255;
+	uint8_t table[256];
+	for (int v = 0; v < 256; v++){
+		table[v] = v;
+		for (int k = 1; k < divisions; k++){
+			if (v <= invals[k]){
+				table[v] = v-invals[k-1] > invals[k]-v ? outvals[k] : outvals[k-1];
+				break;
+			}
+		}
+	}
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			row[x] = table[row[x]];
+		}
+	}
+}
+
+void img8_quantize(Image8 *img, int divisions){
+	int min = 255, max = 0;
+	img8_range(img,&min,&max);
+	img8_quantize_range(img,divisions,min,max);
+}
+
+void img8_half(Image8 *dst, Image8 *src){
+	image8_alloc(dst,MAX(1,src->width/2),MAX(1,src->height/2));
+	img8_half_into(dst,src);
+}
+
+void img8_half_into(Image8 *dst, Image8 *src){
+	for (int y = 0; y < dst->height; y++){
+		uint8_t *r0 = image8_row(src,MIN(y*2,src->height-1));
+		uint8_t *r1 = image8_row(src,MIN(y*2+1,src->height-1));
+		uint8_t *d = image8_row(dst,y);
+		for (int x = 0; x < dst->width; x++){
+			int x0 = MIN(x*2,src->width-1);
+			int x1 = MIN(x*2+1,src->width-1);
+			d[x] = (r0[x0]+r0[x1]+r1[x0]+r1[x1]+2)/4;
+		}
+	}
+}
+
+static void rect8_scan(Image8 *img, uint16_t *runs, size_t runs_stride, ColorRects *rects, int min_dim, bool seam_above, bool seam_below){
+	for (int y = 0; y < img->height; y++){
+		row_runs8(runs+y*runs_stride,image8_row(img,y),img->width);
+	}
+	for (int y = 0; y < img->height; y++){
+		for (int x = 0; x < img->width; x++){
+			if (!runs[y*runs_stride+x]) continue;
+			uint8_t c = image8_row(img,y)[x];
+			int j;
+			int lim = img->width;
+			int stop = x;
+			for (j = y; j < img->height; j++){
+				int end = image8_row(img,j)[x] == c ? x+runs[j*runs_stride+x] : x;
+				if (end < lim){
+					if (lim != img->width){
+						stop = end;
+						break;
 					}
+					lim = end;
 				}
+				if (lim-x < min_dim) break;
 			}
+			int width = lim-x;
+			int height = j-y;
+			bool seam = (seam_above && y == 0) || (seam_below && j == img->height);
+			if (width >= min_dim && height >= (seam ? 1 : min_dim)){
+				color_rects_append(rects,x,y,width,height,RGBA(c,c,c,255));
+				take_rect(runs,runs_stride,x,y,width,height);
+			} else {
+				x = stop;
+			}
+		}
+	}
+}
+
+void img8_rect_decompose(Image8 *img, Image *dst, ColorRects *rects, int min_dim, uint64_t stream){
+	if (img->width > COLOR_RECT_MAX_DIM || img->height > COLOR_RECT_MAX_DIM){
+		decompose_tiles(dst,img,rects,min_dim,stream,false,0);
+		return;
+	}
+	int first = rects->used;
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	uint16_t *runs = arena_alloc(scratch,(size_t)img->width*img->height*sizeof(*runs));
+	rect8_scan(img,runs,img->width,rects,min_dim,false,false);
+	fill_random(dst,rects,first,stream);
+	arena_release(scratch,mark);
+}
+
+TSTRUCT(StripeJob){
+	Image *img;
+	Image8 *img8;
+	uint16_t *runs;//for the whole image, each stripe's scan uses its rows
+	ColorRects *stripes;
+	int stripe_count;
+	int *stripe_top;//stripe_count+1 entries, the last is the image height
+	int min_dim;
+	Cancel *cancel;
+	volatile int next_stripe;
+};
+
+static void stripe_worker(void *arg){
+	StripeJob *job = arg;
+	int s;
+	while ((s = atomic_add_int(&job->next_stripe,1)-1) < job->stripe_count){
+		if (cancelled(job->cancel)) break;
+		int y0 = job->stripe_top[s], y1 = job->stripe_top[s+1];
+		if (job->img){
+			Image view = image_view(job->img,0,y0,job->img->width,y1-y0);
+			img_alpha255(&view);
+			rect_scan(&view,job->runs+(size_t)y0*view.width,view.width,job->stripes+s,job->min_dim,s > 0,s < job->stripe_count-1);
+		} else {
+			Image8 view = image8_view(job->img8,0,y0,job->img8->width,y1-y0);
+			rect8_scan(&view,job->runs+(size_t)y0*view.width,view.width,job->stripes+s,job->min_dim,s > 0,s < job->stripe_count-1);
 		}
 	}
-	memset(img->pixels,0,img->width*img->height*sizeof(*img->pixels));
-	for (ColorRect *r = crl->elements; r < crl->elements+crl->used; r++){
-		uint32_t color = RGBA(rand_int(256),rand_int(256),rand_int(256),255);
-		for (int y = r->top; y < r->bottom; y++){
-			for (int x = r->left; x < r->right; x++){
-				img->pixels[y*img->width+x] = color;
+}
+
+TSTRUCT(MergedRect){
+	int x, y, width, height;
+	uint32_t color;
+};
+
+/*
+Appends the stripes' rectangles to rects in raster order, joining each one
+that starts on a stripe's top row to the rectangle ending on the row above
+it if they have the same color and x extent. Rectangles can't overlap, so
+only one can end on a seam at a given x. Pieces the seams kept that are
+still shorter than min_dim after joining are dropped.
+*/
+static void merge_stripes(ColorRects *rects, StripeJob *job, int width){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	int total = 0;
+	for (int s = 0; s < job->stripe_count; s++){
+		total += job->stripes[s].used;
+	}
+	MergedRect *merged = arena_alloc(scratch,MAX(1,total)*sizeof(*merged));
+	int *open = arena_alloc(scratch,width*sizeof(*open));//merged rectangle ending on the seam above the current stripe at each x, or -1
+	int *next_open = arena_alloc(scratch,width*sizeof(*next_open));
+	memset(open,-1,width*sizeof(*open));
+	int count = 0;
+	for (int s = 0; s < job->stripe_count; s++){
+		ColorRects *r = job->stripes+s;
+		int y0 = job->stripe_top[s];
+		int stripe_height = job->stripe_top[s+1]-y0;
+		memset(next_open,-1,width*sizeof(*next_open));
+		for (int i = 0; i < r->used; i++){
+			int x = r->x[i];
+			uint32_t c = color_rects_get_color(r,i);
+			int k = r->y[i] == 0 ? open[x] : -1;
+			if (k >= 0 && merged[k].width == r->width[i] && merged[k].color == c){
+				merged[k].height += r->height[i];
+			} else {
+				k = count++;
+				merged[k] = (MergedRect){x,y0+r->y[i],r->width[i],r->height[i],c};
 			}
+			if (r->y[i]+r->height[i] == stripe_height) next_open[x] = k;
 		}
+		int *swap = open;
+		open = next_open;
+		next_open = swap;
+	}
+	for (int i = 0; i < count; i++){
+		MergedRect *m = merged+i;
+		if (m->height >= job->min_dim) color_rects_append(rects,m->x,m->y,m->width,m->height,m->color);
+	}
+	arena_release(scratch,mark);
+}
+
+//pixels of row y that differ from the row above
+static int row_changes(StripeJob *job, int y){
+	int changes = 0;
+	if (job->img){
+		uint32_t *a = image_row(job->img,y-1), *b = image_row(job->img,y);
+		for (int x = 0; x < job->img->width; x++) changes += a[x] != b[x];
+	} else {
+		uint8_t *a = image8_row(job->img8,y-1), *b = image8_row(job->img8,y);
+		for (int x = 0; x < job->img8->width; x++) changes += a[x] != b[x];
+	}
+	return changes;
+}
+
+//moves each seam within a quarter stripe of its even spot to the row with the most changes from the row above, where the fewest rectangles would have crossed it
+static void place_seams(StripeJob *job, int height){
+	int stripe_rows = height/job->stripe_count;
+	job->stripe_top[0] = 0;
+	job->stripe_top[job->stripe_count] = height;
+	for (int s = 1; s < job->stripe_count; s++){
+		int even = s*stripe_rows;
+		int best = even, best_changes = -1;
+		for (int y = even-stripe_rows/4; y <= even+stripe_rows/4; y++){
+			int changes = row_changes(job,y);
+			if (changes > best_changes){
+				best = y;
+				best_changes = changes;
+			}
+		}
+		job->stripe_top[s] = best;
+	}
+}
+
+//the size alone decides the seams, so the output doesn't depend on the machine
+static int stripe_count(int width, int height){
+	size_t by_pixels = (size_t)width*height/RECT_STRIPE_MIN_PIXELS;
+	return CLAMP((int)MIN(by_pixels,(size_t)height/RECT_STRIPE_MIN_ROWS),1,RECT_STRIPE_COUNT);
+}
+
+static void decompose_stripes(StripeJob *job, ColorRects *rects, int width, int height){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	job->stripe_count = stripe_count(width,height);
+	job->stripe_top = arena_alloc(scratch,(job->stripe_count+1)*sizeof(*job->stripe_top));
+	place_seams(job,height);
+	job->stripes = arena_zalloc(scratch,job->stripe_count*sizeof(*job->stripes));
+	job->runs = arena_alloc(scratch,(size_t)width*height*sizeof(*job->runs));
+	job->next_stripe = 0;
+	int thread_count = MIN(job->stripe_count,cpu_count());
+	Thread *threads = arena_alloc(scratch,thread_count*sizeof(*threads));
+	for (int i = 1; i < thread_count; i++){
+		thread_create(threads+i,stripe_worker,job);
+	}
+	stripe_worker(job);
+	for (int i = 1; i < thread_count; i++){
+		thread_join(threads[i]);
+	}
+	if (!cancelled(job->cancel)) merge_stripes(rects,job,width);//some stripes weren't scanned
+	for (int s = 0; s < job->stripe_count; s++){
+		color_rects_free(job->stripes+s);
+	}
+	arena_release(scratch,mark);
+}
+
+void img_rect_decompose_parallel(Image *img, ColorRects *rects, int min_dim, uint64_t stream, Cancel *cancel){
+	if (img->width > COLOR_RECT_MAX_DIM || img->height > COLOR_RECT_MAX_DIM){
+		decompose_tiles(img,0,rects,min_dim,stream,true,cancel);
+		return;
+	}
+	if (stripe_count(img->width,img->height) == 1){
+		img_rect_decompose(img,rects,min_dim,stream);
+		return;
+	}
+	int first = rects->used;
+	StripeJob job = {.img = img, .min_dim = min_dim, .cancel = cancel};
+	decompose_stripes(&job,rects,img->width,img->height);
+	fill_random(img,rects,first,stream);
+}
+
+void img8_rect_decompose_parallel(Image8 *img, Image *dst, ColorRects *rects, int min_dim, uint64_t stream, Cancel *cancel){
+	if (img->width > COLOR_RECT_MAX_DIM || img->height > COLOR_RECT_MAX_DIM){
+		decompose_tiles(dst,img,rects,min_dim,stream,true,cancel);
+		return;
+	}
+	if (stripe_count(img->width,img->height) == 1){
+		img8_rect_decompose(img,dst,rects,min_dim,stream);
+		return;
 	}
+	int first = rects->used;
+	StripeJob job = {.img8 = img, .min_dim = min_dim, .cancel = cancel};
+	decompose_stripes(&job,rects,img->width,img->height);
+	fill_random(dst,rects,first,stream);
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #include <renderer.h>
 #include <nfd.h>
 #include <dictionary.h>
+#include <pipeline.h>
+#include <sdf_font.h>
+#include <trace.h>
+#include <frame_stats.h>
 
 TSTRUCT(Camera){
 	vec3 position;
@@ -28,8 +32,11 @@ void get_view(mat4 m, Camera *cam){
 	glm_mat4_mul(m,trans,m);
 }
 
+FrameStats frame_stats;
+
 FT_Library ftlib;
 FT_Face uiface;
+SDFFont uisdf;
 void load_font(char *path, FT_Face *face){
 	FT_Error error = FT_New_Face(ftlib,path,0,face);
 	if (error == FT_Err_Unknown_File_Format){
@@ -40,13 +47,19 @@ void load_font(char *path, FT_Face *face){
 }
 
 TSTRUCT(ImageTexture){
-	Image image;
-	Texture texture;
+	StageImage image, preview;
+	TiledTexture texture, preview_texture;//kept apart so neither is resized by the other's updates
 };
-ImageTexture images[5];
+ImageTexture images[STAGE_COUNT];//render thread copies of the latest published stage images
+
+bool showing_preview(ImageTexture *t){
+	return t->preview.generation > t->image.generation;
+}
 bool greyscale = false;
 int gaussianBlurStrength = 9;
 int quantizeDivisions = 4;
+bool paletteQuantize = false;//opt-in, quantizeDivisions stays levels per channel by default
+bool guidedFilter = false;
 int rectangleDecomposeMinDim = 25;
 
 int scale = 1;
@@ -70,52 +83,17 @@ TSTRUCT(Button){
 #define BUTTON_GREEN (0x7B9944 | (RR_DISH<<24))
 #define BUTTON_GREEN_HIGHLIGHTED (0x9ABC56 | (RR_DISH<<24))
 bool useNewDecompose = true;
-void update(){
-	size_t size = images[0].image.width*images[0].image.height*sizeof(*images[0].image.pixels);
-	memcpy(images[1].image.pixels,images[0].image.pixels,size);
-	if (greyscale){
-		img_greyscale(&images[1].image);
-	}
-	img_gaussian_blur(&images[1].image,gaussianBlurStrength);
-	memcpy(images[2].image.pixels,images[1].image.pixels,size);
-	img_quantize(&images[2].image,quantizeDivisions);
-	memcpy(images[3].image.pixels,images[2].image.pixels,size);
-
-	ColorRectList crl = {0};
-	img_rect_decompose(&images[3].image,&crl,rectangleDecomposeMinDim);
-
-	/*
-	if (gtext.ptr){
-		WordArray wa;
-		WordsByAspect(&wa,&gtext,NOUN|VERB,0,"Consolas",LOWER_CASE);
-		WordReconstruct(&images[4].image,&crl,&wa,"Consolas");
-		if (wa.len){
-			free(wa.words);
-		}
-	}*/
-
-	for (ImageTexture *it = images; it < images+COUNT(images); it++){
-		texture_from_image(&it->texture,&it->image);
-	}
+void update(int first_stage){//requeues stages >= first_stage on the pipeline worker, earlier stages are left as they are
+	PipelineParams params = {greyscale,gaussianBlurStrength,quantizeDivisions,rectangleDecomposeMinDim,paletteQuantize,guidedFilter};
+	pipeline_submit(&params,first_stage,0);
 }
 void open_image(){
 	nfdchar_t *path;
 	nfdfilteritem_t filterItem[1] = {{ "Image", "png,jpg" }};
 	nfdresult_t result = NFD_OpenDialog(&path, filterItem, 1, NULL);
 	if (result == NFD_OKAY){
-		if (images[0].image.pixels){
-			for (int i = 0; i < COUNT(images); i++){
-				free(images[i].image.pixels);
-				memset(&images[i].image,0,sizeof(images[i].image));
-			}
-		}
-		load_image(&images[0].image,path);
-		for (int i = 1; i < COUNT(images); i++){
-			images[i].image.width = images[0].image.width;
-			images[i].image.height = images[0].image.height;
-			images[i].image.pixels = malloc_or_die(images[0].image.width*images[0].image.height*sizeof(*images[0].image.pixels));
-		}
-		update();
+		PipelineParams params = {greyscale,gaussianBlurStrength,quantizeDivisions,rectangleDecomposeMinDim,paletteQuantize,guidedFilter};
+		pipeline_submit(&params,STAGE_SOURCE,path);//decoded on the worker
 		cstr_to_string(path,&imagePath);
 		NFD_FreePath(path);
 	} else if (result == NFD_CANCEL){
@@ -124,15 +102,47 @@ void open_image(){
 		printf("Error: %s\n", NFD_GetError());
 	}
 }
+void set_param(int *param, int value, int min, int max, int stage){
+	value = CLAMP(value,min,max);
+	if (value == *param) return;
+	*param = value;
+	if (imagePath.len) update(stage);
+}
+void toggle_greyscale();
+void toggle_palette_quantize();
+void toggle_guided_filter();
+void blur_down(){ set_param(&gaussianBlurStrength,gaussianBlurStrength-1,2,100,STAGE_BLUR); }
+void blur_up(){ set_param(&gaussianBlurStrength,gaussianBlurStrength+1,2,100,STAGE_BLUR); }
+void quantize_down(){ set_param(&quantizeDivisions,quantizeDivisions-1,2,64,STAGE_QUANTIZE); }
+void quantize_up(){ set_param(&quantizeDivisions,quantizeDivisions+1,2,64,STAGE_QUANTIZE); }
+void min_dim_down(){ set_param(&rectangleDecomposeMinDim,rectangleDecomposeMinDim-1,1,1000,STAGE_DECOMPOSE); }
+void min_dim_up(){ set_param(&rectangleDecomposeMinDim,rectangleDecomposeMinDim+1,1,1000,STAGE_DECOMPOSE); }
 Button buttons[] = {
 	{50,14,46,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Open Image",open_image},
 	{50,14+26*1,46,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Open Text",0},
-	{50,14+26*2,46,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Greyscale: Off",0},
-	{14,14+26*3,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",0},{200,14+26*3,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",0},
-	{14,14+26*4,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",0},{200,14+26*4,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",0},
-	{14,14+26*5,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",0},{200,14+26*5,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",0},
+	{50,14+26*2,46,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Greyscale: Off",toggle_greyscale},
+	{14,14+26*3,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",blur_down},{200,14+26*3,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",blur_up},
+	{14,14+26*4,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",quantize_down},{200,14+26*4,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",quantize_up},
+	{14,14+26*5,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"-",min_dim_down},{200,14+26*5,10,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),L"+",min_dim_up},
 	{50+68-46,14+26*6,68,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Rct. Decompose: New",0},
+	{50+68-46,14+26*7,68,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Quantize: Levels",toggle_palette_quantize},
+	{50+68-46,14+26*8,68,10,10,BUTTON_GREY,RGBA(0,0,0,RR_ICON_NONE),"Blur: Gaussian",toggle_guided_filter},
 };
+void toggle_greyscale(){
+	greyscale = !greyscale;
+	buttons[2].string = greyscale ? "Greyscale: On" : "Greyscale: Off";
+	if (imagePath.len) update(STAGE_BLUR);
+}
+void toggle_palette_quantize(){
+	paletteQuantize = !paletteQuantize;
+	buttons[10].string = paletteQuantize ? "Quantize: Palette" : "Quantize: Levels";
+	if (imagePath.len) update(STAGE_QUANTIZE);
+}
+void toggle_guided_filter(){
+	guidedFilter = !guidedFilter;
+	buttons[11].string = guidedFilter ? "Blur: Guided" : "Blur: Gaussian";
+	if (imagePath.len) update(STAGE_BLUR);
+}
 bool point_in_button(int buttonX, int buttonY, int halfWidth, int halfHeight, int x, int y){
 	return abs(x-buttonX) < halfWidth && abs(y-buttonY) < halfHeight;
 }
@@ -145,6 +155,12 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	switch (action){
 		case GLFW_PRESS:{
 			switch (key){
+				case GLFW_KEY_F3:
+					frame_stats.visible = !frame_stats.visible;
+					break;
+				case GLFW_KEY_F9:
+					trace_dump("wordcloud_trace.json");
+					break;
 			}
 			break;
 		}
@@ -165,7 +181,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 				case GLFW_MOUSE_BUTTON_LEFT:{
 					for (Button *b = buttons; b < buttons+COUNT(buttons); b++){
 						if (point_in_button(b->x,b->y,b->halfWidth,b->halfHeight,xpos,ypos)){
-							b->func();
+							if (b->func) b->func();
 							break;
 						}
 					}
@@ -273,15 +289,30 @@ void main(void)
 
 	compile_shaders();
 
-	srand(time(0));
+	RoundedRectBatch rrb;
+	rounded_rect_batch_init(&rrb);
+	RoundedRectInstanceList rrl = {0};
+	frame_stats_init(&frame_stats);
+
+	char *seed = getenv("WORDCLOUD_SEED");//set it to get the same random colors every run
+	rand_seed(seed ? strtoull(seed,0,10) : (uint64_t)time(0));
 
 	if (FT_Init_FreeType(&ftlib)){
 		fatal_error("Failed to initialize freetype");
 	}
 	load_font("../res/Nunito-Regular.ttf",&uiface);
+	sdf_font_init(&uisdf,uiface);
+	TextureColorVertexList text_verts = {0};
 
 	NFD_Init();
 
+	char *budget_mb = getenv("WORDCLOUD_MEMORY_BUDGET_MB");//images past a share of this go out-of-core
+	if (budget_mb && atoll(budget_mb) > 0){
+		memory_budget = (size_t)atoll(budget_mb) << 20;
+	}
+	scratch_dir = getenv("WORDCLOUD_SCRATCH_DIR");
+	pipeline_start();
+
 	parse_dictionary_file();
 
 	print_word_type("fuck");
@@ -291,10 +322,17 @@ void main(void)
 	camera.position[2] = 2;
 	camera.euler[0] = -0.25f*M_PI;
 
+	trace_thread_name("main");
+
 	double t0 = glfwGetTime();
+	int frame = 0;
  
 	while (!glfwWindowShouldClose(window))
 	{
+		frame++;
+		double frame_start = trace_begin();
+		frame_stats_begin_frame(&frame_stats);
+		arena_reset(scratch_arena());//per-frame scope
 		double t1 = glfwGetTime();
 		double dt = t1 - t0;
 		t0 = t1;
@@ -315,14 +353,35 @@ void main(void)
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
 
+		double trace_start = trace_begin();
+		for (int i = 0; i < COUNT(images); i++){
+			for (int preview = 0; preview < 2; preview++){
+				StageImage *img = pipeline_acquire(i,preview);
+				if (!img) continue;
+				StageImage *dst = preview ? &images[i].preview : &images[i].image;
+				TiledTexture *texture = preview ? &images[i].preview_texture : &images[i].texture;
+				*dst = *img;
+				//visible tiles get re-uploaded when they're next drawn, grey stages go up as one channel
+				if (img->grey){
+					tiled_texture_set_image8(texture,&dst->grey8,dst->grey_levels,dst->level_count);
+				} else {
+					tiled_texture_set_image(texture,&dst->rgba,dst->rgba_levels,dst->level_count);
+				}
+			}
+		}
+		trace_end("acquire",trace_start);
+
+		trace_start = trace_begin();
+		frame_stats_begin_pass(&frame_stats,GPU_PASS_IMAGES);
 		glUseProgram(texture_color_shader.id);
-		if (imagePath.len){
-			float totalHeight = (float)images[0].image.height*COUNT(images);
-			float width = MIN(client_width,images[0].image.width);
-			float height = width * (totalHeight/(float)images[0].image.width);
+		StageImage *shown = showing_preview(images) ? &images[0].preview : &images[0].image;
+		if (shown->rgba.pixels){
+			float totalHeight = (float)shown->source_height*COUNT(images);
+			float width = MIN(client_width,shown->source_width);
+			float height = width * (totalHeight/(float)shown->source_width);
 			if (height > client_height){
 				height = client_height;
-				width = height * ((float)images[0].image.width/totalHeight);
+				width = height * ((float)shown->source_width/totalHeight);
 			}
 			width *= scale;
 			height *= scale;
@@ -333,77 +392,75 @@ void main(void)
 			}
 
 			glUniform1i(texture_color_shader.uTex,0);
-			TextureColorVertex v[6] = {
-				{{0,1,0},{0,0},RGBA(255,255,255,255)},
-				{{0,0,0},{0,1},RGBA(255,255,255,255)},
-				{{1,0,0},{1,1},RGBA(255,255,255,255)},
-				{{1,0,0},{1,1},RGBA(255,255,255,255)},
-				{{1,1,0},{1,0},RGBA(255,255,255,255)},
-				{{0,1,0},{0,0},RGBA(255,255,255,255)}
-			};
-			GPUMesh imageQuad;
-			gpu_mesh_from_texture_color_verts(&imageQuad,v,COUNT(v));
-			glBindVertexArray(imageQuad.vao);
-			mat4 mata,matb,matc;
 			float individualHeight = height/COUNT(images);
 			for (int i = 0; i < COUNT(images); i++){
-				glBindTexture(GL_TEXTURE_2D,images[i].texture.id);
-				glm_scale_make(matb,(vec3){width,individualHeight,1});
-				glm_translate_make(mata,(vec3){pos[0],client_height-1-pos[1]-(i+1)*individualHeight,pos[2]});
-				glm_mat4_mul(mata,matb,matc);
-				glm_mat4_mul(ortho,matc,mata);
-				glUniformMatrix4fv(texture_color_shader.uMVP,1,GL_FALSE,(GLfloat *)mata);
-				glDrawArrays(GL_TRIANGLES,0,imageQuad.vertex_count);
+				draw_tiled_texture(showing_preview(images+i) ? &images[i].preview_texture : &images[i].texture,ortho,pos[0],client_height-1-pos[1]-(i+1)*individualHeight,pos[2],width,individualHeight,client_width,client_height,frame);
 			}
-			delete_gpu_mesh(&imageQuad);
 		}
+		frame_stats_end_pass(&frame_stats,GPU_PASS_IMAGES);
+		trace_end("draw images",trace_start);
 
+		trace_start = trace_begin();
+		frame_stats_begin_pass(&frame_stats,GPU_PASS_BUTTONS);
 		glUseProgram(rounded_rect_shader.id);
 		glUniformMatrix4fv(rounded_rect_shader.proj,1,GL_FALSE,(GLfloat *)ortho);
-		RoundedRectVertexList rrvl = {0};
+		RoundedRectInstanceListClear(&rrl);
 		for (Button *b = buttons; b < buttons+COUNT(buttons); b++){
-			append_rounded_rect(&rrvl,b->x,client_height-1-b->y,0,b->halfWidth,b->halfHeight,b->roundingRadius,b->color,b->IconColor);
-		}
-		if (rrvl.used){
-			GPUMesh button_mesh;
-			gpu_mesh_from_rounded_rect_verts(&button_mesh,rrvl.elements,rrvl.used);
-			glDrawArrays(GL_TRIANGLES,0,rrvl.used);
-			free(rrvl.elements);
-			delete_gpu_mesh(&button_mesh);
+			append_rounded_rect(&rrl,b->x,client_height-1-b->y,0,b->halfWidth,b->halfHeight,b->roundingRadius,b->color,b->IconColor);
 		}
-
-		glUseProgram(texture_color_shader.id);
-		Image text_image;
-		new_image(&text_image,client_width,client_height);
+		frame_stats_append_rects(&frame_stats,&rrl,client_width,client_height);
+		draw_rounded_rect_batch(&rrb,rrl.elements,rrl.used);
+		frame_stats_end_pass(&frame_stats,GPU_PASS_BUTTONS);
+		trace_end("draw buttons",trace_start);
+
+		trace_start = trace_begin();
+		frame_stats_begin_pass(&frame_stats,GPU_PASS_TEXT);
+		glUseProgram(sdf_text_shader.id);
+		glDisable(GL_DEPTH_TEST);//glyph quads overlap their neighbours' padding
+		TextureColorVertexListClear(&text_verts);
 		for (Button *b = buttons; b < buttons+COUNT(buttons); b++){
-			draw_string_centered(&text_image,b->x,abs(b->y),uiface,12,RGB(255,255,255),strlen(b->string),b->string);
+			append_sdf_string_centered(&text_verts,&uisdf,b->x,client_height-1-b->y,0,12,RGBA(255,255,255,255),strlen(b->string),b->string);
+		}
+		for (int i = 0, y = 14+26*9; i < COUNT(images); i++){
+			int status = pipeline_stage_status(i);
+			if (status != STAGE_DONE){
+				char str[64];
+				snprintf(str,COUNT(str),"%s: %s",get_stage_name(i),status == STAGE_RUNNING ? "running..." : status == STAGE_PREVIEW ? "refining..." : "queued");
+				append_sdf_string(&text_verts,&uisdf,8,client_height-1-y,0,12,RGBA(255,255,255,255),strlen(str),str);
+				y += 16;
+			}
 		}
-		Texture text_texture;
-		texture_from_image(&text_texture,&text_image);
-		TextureColorVertex screen_quad[6] = {
-			-1,1,-1, 0,0, 0xffffffff,
-			-1,-1,-1, 0,1, 0xffffffff,
-			1,-1,-1, 1,1, 0xffffffff,
-
-			1,-1,-1, 1,1, 0xffffffff,
-			1,1,-1, 1,0, 0xffffffff,
-			-1,1,-1, 0,0, 0xffffffff,
-		};
-		GPUMesh text_mesh;
-		gpu_mesh_from_texture_color_verts(&text_mesh,screen_quad,COUNT(screen_quad));
-		glUniform1i(texture_color_shader.uTex,0);
-		glUniformMatrix4fv(texture_color_shader.uMVP,1,GL_FALSE,(GLfloat *)GLM_MAT4_IDENTITY);
-		glDrawArrays(GL_TRIANGLES,0,COUNT(screen_quad));
-		delete_gpu_mesh(&text_mesh);
-		delete_texture(&text_texture);
-		free(text_image.pixels);
+		frame_stats_append_text(&frame_stats,&text_verts,&uisdf,client_width,client_height);
+		if (text_verts.used){
+			GPUMesh text_mesh;
+			gpu_mesh_from_sdf_text_verts(&text_mesh,text_verts.elements,text_verts.used);
+			sdf_font_bind(&uisdf);
+			glUniform1i(sdf_text_shader.uTex,0);
+			glUniformMatrix4fv(sdf_text_shader.uMVP,1,GL_FALSE,(GLfloat *)ortho);
+			glDrawArrays(GL_TRIANGLES,0,text_verts.used);
+			delete_gpu_mesh(&text_mesh);
+		}
+		frame_stats_end_pass(&frame_stats,GPU_PASS_TEXT);
+		trace_end("draw text",trace_start);
 
 		glCheckError();
+		frame_stats_end_frame(&frame_stats);
  
+		trace_start = trace_begin();
 		glfwSwapBuffers(window);
+		trace_end("swap",trace_start);
 		glfwPollEvents();
+		trace_end("frame",frame_start);
 	}
  
+	pipeline_stop();
+	arena_report(scratch_arena());
+
+	char *trace_path = getenv("WORDCLOUD_TRACE");
+	if (trace_path){
+		trace_dump(trace_path);
+	}
+
 	glfwDestroyWindow(window);
  
 	NFD_Quit();
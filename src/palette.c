@@ -0,0 +1,260 @@
+#include <palette.h>
+#include <trace.h>
+#include <math.h>
+
+static float srgb_to_linear(float c){
+	c /= 255.0f;
+	return c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f,2.4f);
+}
+
+//https://bottosson.github.io/posts/oklab/
+static void srgb_to_oklab(float *lab, float r, float g, float b){
+	r = srgb_to_linear(r);
+	g = srgb_to_linear(g);
+	b = srgb_to_linear(b);
+	float l = cbrtf(0.4122214708f*r + 0.5363325363f*g + 0.0514459929f*b);
+	float m = cbrtf(0.2119034982f*r + 0.6806995451f*g + 0.1073970566f*b);
+	float s = cbrtf(0.0883024619f*r + 0.2817188376f*g + 0.6299787005f*b);
+	lab[0] = 0.2104542553f*l + 0.7936177850f*m - 0.0040720468f*s;
+	lab[1] = 1.9779984951f*l - 2.4285922050f*m + 0.4505937099f*s;
+	lab[2] = 0.0259040371f*l + 0.7827717662f*m - 0.8086757660f*s;
+}
+
+static float distance2(float *a, float *b, int dims){
+	float d = 0;
+	for (int i = 0; i < dims; i++){
+		d += (a[i]-b[i])*(a[i]-b[i]);
+	}
+	return d;
+}
+
+static int nearest(float *pos, float *centroids, int k, int dims){
+	int best = 0;
+	float best_d = distance2(pos,centroids,dims);
+	for (int c = 1; c < k; c++){
+		float d = distance2(pos,centroids+c*dims,dims);
+		if (d < best_d){
+			best_d = d;
+			best = c;
+		}
+	}
+	return best;
+}
+
+//weighted k-means over n points, assign[i] ends up as point i's centroid
+static void kmeans(float *pos, double *weight, int n, int dims, int k, float *centroids, int *assign){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	//seed with the heaviest point, then greedily the point with the most weight*distance^2 to its nearest seed
+	float *min_d = arena_alloc(scratch,n*sizeof(*min_d));
+	int first = 0;
+	for (int i = 1; i < n; i++){
+		if (weight[i] > weight[first]) first = i;
+	}
+	memcpy(centroids,pos+first*dims,dims*sizeof(*centroids));
+	for (int i = 0; i < n; i++){
+		min_d[i] = distance2(pos+i*dims,centroids,dims);
+	}
+	for (int c = 1; c < k; c++){
+		int pick = 0;
+		for (int i = 1; i < n; i++){
+			if (weight[i]*min_d[i] > weight[pick]*min_d[pick]) pick = i;
+		}
+		memcpy(centroids+c*dims,pos+pick*dims,dims*sizeof(*centroids));
+		for (int i = 0; i < n; i++){
+			min_d[i] = MIN(min_d[i],distance2(pos+i*dims,centroids+c*dims,dims));
+		}
+	}
+	double *sums = arena_alloc(scratch,k*(dims+1)*sizeof(*sums));
+	for (int i = 0; i < n; i++){
+		assign[i] = -1;
+	}
+	for (int iteration = 0; iteration < PALETTE_ITERATIONS; iteration++){
+		bool changed = false;
+		for (int i = 0; i < n; i++){
+			int c = nearest(pos+i*dims,centroids,k,dims);
+			changed |= c != assign[i];
+			assign[i] = c;
+		}
+		if (!changed) break;
+		memset(sums,0,k*(dims+1)*sizeof(*sums));
+		for (int i = 0; i < n; i++){
+			double *s = sums+assign[i]*(dims+1);
+			for (int d = 0; d < dims; d++){
+				s[d] += weight[i]*pos[i*dims+d];
+			}
+			s[dims] += weight[i];
+		}
+		for (int c = 0; c < k; c++){
+			double *s = sums+c*(dims+1);
+			if (!s[dims]) continue;//empty cluster, keep its centroid where it was
+			for (int d = 0; d < dims; d++){
+				centroids[c*dims+d] = s[d]/s[dims];
+			}
+		}
+	}
+	arena_release(scratch,mark);
+}
+
+static int bin_of(uint32_t c){
+	return ((c >> 3) & 31) | (((c >> 11) & 31) << 5) | (((c >> 19) & 31) << 10);
+}
+
+void histogram_clear(ColorHistogram *h){
+	memset(h,0,sizeof(*h));
+}
+
+void histogram_add(ColorHistogram *h, Image *img){
+	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			uint32_t c = row[x];
+			int b = bin_of(c);
+			h->count[b]++;
+			h->sum[b][0] += c & 255;
+			h->sum[b][1] += (c >> 8) & 255;
+			h->sum[b][2] += (c >> 16) & 255;
+		}
+	}
+}
+
+void palette_build(Palette *p, ColorHistogram *h, int colors){
+	double t = trace_begin();
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	int *bins = arena_alloc(scratch,PALETTE_BINS*sizeof(*bins));
+	int n = 0;
+	for (int b = 0; b < PALETTE_BINS; b++){
+		if (h->count[b]) bins[n++] = b;
+	}
+	float *pos = arena_alloc(scratch,MAX(1,n)*3*sizeof(*pos));
+	double *weight = arena_alloc(scratch,MAX(1,n)*sizeof(*weight));
+	int *assign = arena_alloc(scratch,MAX(1,n)*sizeof(*assign));
+	for (int i = 0; i < n; i++){
+		int b = bins[i];
+		double count = h->count[b];
+		srgb_to_oklab(pos+i*3,h->sum[b][0]/count,h->sum[b][1]/count,h->sum[b][2]/count);
+		weight[i] = count;
+	}
+	p->count = MIN(MIN(colors,PALETTE_MAX),n);
+	memset(p->lut,0,sizeof(p->lut));
+	if (!p->count){
+		p->count = 1;
+		p->colors[0] = 0;
+		arena_release(scratch,mark);
+		trace_end("palette build",t);
+		return;
+	}
+	float centroids[PALETTE_MAX*3];
+	kmeans(pos,weight,n,3,p->count,centroids,assign);
+	//the colors are their pixels' mean, not the centroids converted back, so they're colors that were really there
+	uint64_t (*sums)[4] = arena_zalloc(scratch,p->count*sizeof(*sums));
+	for (int i = 0; i < n; i++){
+		int b = bins[i];
+		uint64_t *s = sums[assign[i]];
+		s[0] += h->sum[b][0];
+		s[1] += h->sum[b][1];
+		s[2] += h->sum[b][2];
+		s[3] += h->count[b];
+		p->lut[b] = assign[i];
+	}
+	for (int c = 0; c < p->count; c++){
+		uint64_t *s = sums[c];
+		p->colors[c] = s[3] ? RGB((int)((s[0]+s[3]/2)/s[3]),(int)((s[1]+s[3]/2)/s[3]),(int)((s[2]+s[3]/2)/s[3])) : 0;
+	}
+	//bins no pixel fell in go to the centroid nearest their center, for palettes applied to other images
+	for (int b = 0; b < PALETTE_BINS; b++){
+		if (h->count[b]) continue;
+		float lab[3];
+		int half = 1 << (7-PALETTE_BITS);
+		srgb_to_oklab(lab,((b & 31) << 3)+half,(((b >> 5) & 31) << 3)+half,(((b >> 10) & 31) << 3)+half);
+		p->lut[b] = nearest(lab,centroids,p->count,3);
+	}
+	arena_release(scratch,mark);
+	trace_end("palette build",t);
+}
+
+void palette_apply(Palette *p, Image *img){
+	for (int y = 0; y < img->height; y++){
+		uint32_t *row = image_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			uint32_t c = row[x];
+			row[x] = p->colors[p->lut[bin_of(c)]] | (c & 0xff000000);
+		}
+	}
+}
+
+void img_palette_quantize(Image *img, int colors){
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	ColorHistogram *h = arena_alloc(scratch,sizeof(*h));
+	Palette *p = arena_alloc(scratch,sizeof(*p));
+	histogram_clear(h);
+	histogram_add(h,img);
+	palette_build(p,h,colors);
+	palette_apply(p,img);
+	arena_release(scratch,mark);
+}
+
+void grey_histogram_add(uint64_t hist[256], Image8 *img){
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			hist[row[x]]++;
+		}
+	}
+}
+
+void grey_palette_build(uint8_t lut[256], uint64_t hist[256], int colors){
+	//Oklab lightness of a grey is the cube root of its linear value
+	float pos[256], centroids[PALETTE_MAX];
+	double weight[256];
+	int values[256], assign[256];
+	int n = 0;
+	for (int v = 0; v < 256; v++){
+		if (!hist[v]) continue;
+		values[n] = v;
+		pos[n] = cbrtf(srgb_to_linear(v));
+		weight[n] = hist[v];
+		n++;
+	}
+	int k = MIN(MIN(colors,PALETTE_MAX),n);
+	if (!k){
+		for (int v = 0; v < 256; v++) lut[v] = v;
+		return;
+	}
+	kmeans(pos,weight,n,1,k,centroids,assign);
+	uint64_t sums[PALETTE_MAX][2] = {0};
+	for (int i = 0; i < n; i++){
+		sums[assign[i]][0] += values[i]*hist[values[i]];
+		sums[assign[i]][1] += hist[values[i]];
+	}
+	uint8_t greys[PALETTE_MAX];
+	for (int c = 0; c < k; c++){
+		greys[c] = sums[c][1] ? (sums[c][0]+sums[c][1]/2)/sums[c][1] : 0;
+	}
+	for (int v = 0; v < 256; v++){
+		float p = cbrtf(srgb_to_linear(v));
+		lut[v] = greys[nearest(&p,centroids,k,1)];
+	}
+	for (int i = 0; i < n; i++){
+		lut[values[i]] = greys[assign[i]];
+	}
+}
+
+void grey_palette_apply(uint8_t lut[256], Image8 *img){
+	for (int y = 0; y < img->height; y++){
+		uint8_t *row = image8_row(img,y);
+		for (int x = 0; x < img->width; x++){
+			row[x] = lut[row[x]];
+		}
+	}
+}
+
+void img8_palette_quantize(Image8 *img, int colors){
+	uint64_t hist[256] = {0};
+	uint8_t lut[256];
+	grey_histogram_add(hist,img);
+	grey_palette_build(lut,hist,colors);
+	grey_palette_apply(lut,img);
+}
\ No newline at end of file
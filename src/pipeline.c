@@ -0,0 +1,381 @@
+#include <pipeline.h>
+#include <tiled_effects.h>
+#include <trace.h>
+
+static StageBuffer stages[STAGE_COUNT], previews[STAGE_COUNT];//status is only kept in stages
+static Thread worker;
+static Mutex job_mutex;
+static CondVar job_cond;
+static bool job_pending, quit;
+static PipelineParams job_params;
+static int job_first_stage;
+static char *job_source_path;//decoded on the worker
+static volatile int generation;
+static ColorRects decomposed;//the last decomposition's rectangles, only the worker touches it, reusing it means no reallocation once it's grown
+
+static void stage_image_size(StageImage *img, int *width, int *height){
+	*width = img->grey ? img->grey8.width : img->rgba.width;
+	*height = img->grey ? img->grey8.height : img->rgba.height;
+}
+
+//sizes img's storage for the format, the other format's storage is kept for later
+static void stage_image_reserve(StageImage *img, int width, int height, bool grey){
+	img->grey = grey;
+	if (grey){
+		if (img->grey8.width != width || img->grey8.height != height || !img->grey8.pixels){
+			image8_free(&img->grey8);
+			image8_alloc(&img->grey8,width,height);
+		}
+	} else if (img->rgba.width != width || img->rgba.height != height || !img->rgba.pixels){
+		image_free(&img->rgba);
+		image_alloc(&img->rgba,width,height);
+	}
+}
+
+//halves the image in use until it's at most STAGE_LEVEL_MIN_SIZE a side, levels keep their storage while the size matches
+static void stage_image_build_levels(StageImage *img, Cancel *cancel){
+	int width, height;
+	stage_image_size(img,&width,&height);
+	int count = 0;
+	while (MAX(width,height) > STAGE_LEVEL_MIN_SIZE && count < STAGE_LEVELS){
+		width = MAX(1,width/2);
+		height = MAX(1,height/2);
+		if (img->grey){
+			Image8 *dst = img->grey_levels+count;
+			Image8 *src = count ? dst-1 : &img->grey8;
+			if (dst->width != width || dst->height != height || !dst->pixels){
+				image8_free(dst);
+				image8_alloc(dst,width,height);
+			}
+			if (image_out_of_core(src->width,src->height,1)) tiled8_half(dst,src,cancel);
+			else img8_half_into(dst,src);
+		} else {
+			Image *dst = img->rgba_levels+count;
+			Image *src = count ? dst-1 : &img->rgba;
+			if (dst->width != width || dst->height != height || !dst->pixels){
+				image_free(dst);
+				image_alloc(dst,width,height);
+			}
+			if (image_out_of_core(src->width,src->height,sizeof(*src->pixels))) tiled_half(dst,src,cancel);
+			else img_half_into(dst,src);
+		}
+		count++;
+	}
+	img->level_count = count;
+}
+
+static void stage_image_copy(StageImage *dst, StageImage *src){
+	int width, height;
+	stage_image_size(src,&width,&height);
+	stage_image_reserve(dst,width,height,src->grey);
+	if (src->grey){
+		image8_copy(&dst->grey8,&src->grey8);
+	} else {
+		image_copy(&dst->rgba,&src->rgba);
+	}
+	stage_image_build_levels(dst,0);//previews are never big enough to have levels
+}
+
+static void stage_image_free(StageImage *img){
+	image_free(&img->rgba);
+	image8_free(&img->grey8);
+	for (int i = 0; i < STAGE_LEVELS; i++){
+		image_free(img->rgba_levels+i);
+		image8_free(img->grey_levels+i);
+	}
+	memset(img,0,sizeof(*img));
+}
+
+static void publish(StageBuffer *sb){
+	sb->latest = sb->back;
+	sb->back = atomic_exchange_int(&sb->middle,sb->back|STAGE_BUFFER_FRESH) & ~STAGE_BUFFER_FRESH;
+}
+
+//same as apply_stage's switch, for images in scratch files
+static void apply_stage_tiled(int stage, StageImage *out, StageImage *in, bool grey, PipelineParams *params, Cancel *cancel){
+	switch (stage){
+		case STAGE_SOURCE:
+			tiled_copy(&out->rgba,&in->rgba,cancel);
+			break;
+		case STAGE_BLUR:
+			if (grey) tiled_grey8_blur(&out->grey8,&in->rgba,params->gaussianBlurStrength,params->guidedFilter,cancel);
+			else tiled_blur(&out->rgba,&in->rgba,params->gaussianBlurStrength,params->guidedFilter,cancel);
+			break;
+		case STAGE_QUANTIZE:
+			if (params->paletteQuantize){
+				if (grey) tiled8_palette_quantize(&out->grey8,&in->grey8,params->quantizeDivisions,cancel);
+				else tiled_palette_quantize(&out->rgba,&in->rgba,params->quantizeDivisions,cancel);
+			} else {
+				if (grey) tiled8_quantize(&out->grey8,&in->grey8,params->quantizeDivisions,cancel);
+				else tiled_quantize(&out->rgba,&in->rgba,params->quantizeDivisions,cancel);
+			}
+			break;
+		case STAGE_DECOMPOSE:
+			color_rects_clear(&decomposed);
+			if (in->grey) tiled8_rect_decompose(&out->rgba,&in->grey8,&decomposed,params->rectangleDecomposeMinDim,cancel);
+			else tiled_rect_decompose(&out->rgba,&in->rgba,&decomposed,params->rectangleDecomposeMinDim,cancel);
+			break;
+		case STAGE_WORDS:
+			if (grey) tiled8_clear(&out->grey8,cancel);
+			else tiled_clear(&out->rgba,cancel);
+			break;
+	}
+}
+
+static void apply_stage(int stage, StageImage *out, StageImage *in, PipelineParams *params, Cancel *cancel){
+	int width, height;
+	stage_image_size(in,&width,&height);
+	bool grey = stage == STAGE_BLUR ? params->greyscale : in->grey && stage != STAGE_DECOMPOSE;//greyscale runs from the blur stage to the decomposition, which is painted in color
+	stage_image_reserve(out,width,height,grey);
+	double t = trace_begin();
+	bool tiled_decompose = stage == STAGE_DECOMPOSE && (width > DECOMPOSE_TILE_SIZE || height > DECOMPOSE_TILE_SIZE);//the same tiles in or out of core
+	if (tiled_decompose || image_out_of_core(width,height,sizeof(*in->rgba.pixels))){
+		apply_stage_tiled(stage,out,in,grey,params,cancel);
+		trace_end(get_stage_name(stage),t);
+		return;
+	}
+	switch (stage){
+		case STAGE_SOURCE:
+			image_copy(&out->rgba,&in->rgba);
+			break;
+		case STAGE_BLUR:
+			if (grey){
+				img_to_grey8(&out->grey8,&in->rgba);
+				if (params->guidedFilter) img8_guided_filter(&out->grey8,params->gaussianBlurStrength-1);
+				else img8_gaussian_blur(&out->grey8,params->gaussianBlurStrength);
+			} else {
+				image_copy(&out->rgba,&in->rgba);
+				if (params->guidedFilter) img_guided_filter(&out->rgba,params->gaussianBlurStrength-1);
+				else img_gaussian_blur(&out->rgba,params->gaussianBlurStrength);
+			}
+			break;
+		case STAGE_QUANTIZE:
+			if (grey){
+				image8_copy(&out->grey8,&in->grey8);
+				if (params->paletteQuantize) img8_palette_quantize(&out->grey8,params->quantizeDivisions);
+				else img8_quantize(&out->grey8,params->quantizeDivisions);
+			} else {
+				image_copy(&out->rgba,&in->rgba);
+				if (params->paletteQuantize) img_palette_quantize(&out->rgba,params->quantizeDivisions);
+				else img_quantize(&out->rgba,params->quantizeDivisions);
+			}
+			break;
+		case STAGE_DECOMPOSE:
+			color_rects_clear(&decomposed);
+			if (in->grey){
+				img8_rect_decompose_parallel(&in->grey8,&out->rgba,&decomposed,params->rectangleDecomposeMinDim,0,cancel);
+			} else {
+				image_copy(&out->rgba,&in->rgba);
+				img_rect_decompose_parallel(&out->rgba,&decomposed,params->rectangleDecomposeMinDim,0,cancel);
+			}
+			break;
+		case STAGE_WORDS:
+			if (grey) image8_clear(&out->grey8);//word placement isn't implemented yet
+			else image_clear(&out->rgba);
+			break;
+	}
+	trace_end(get_stage_name(stage),t);
+}
+
+static bool params_equal(PipelineParams *a, PipelineParams *b){
+	return a->greyscale == b->greyscale &&
+		a->gaussianBlurStrength == b->gaussianBlurStrength &&
+		a->quantizeDivisions == b->quantizeDivisions &&
+		a->rectangleDecomposeMinDim == b->rectangleDecomposeMinDim &&
+		a->paletteQuantize == b->paletteQuantize &&
+		a->guidedFilter == b->guidedFilter;
+}
+
+//the preview source and cache are only touched by the worker
+static Image preview_source;
+static float preview_factor;
+static PreviewCacheEntry preview_cache[PREVIEW_CACHE_SIZE];
+static int preview_clock;
+
+static void set_preview_source(Image *source){
+	for (PreviewCacheEntry *e = preview_cache; e < preview_cache+PREVIEW_CACHE_SIZE; e++){
+		for (int i = 0; i < STAGE_COUNT; i++){
+			stage_image_free(e->stages+i);
+		}
+		memset(e,0,sizeof(*e));
+	}
+	image_free(&preview_source);
+	memset(&preview_source,0,sizeof(preview_source));
+	if (MAX(source->width,source->height) <= PREVIEW_SIZE) return;//already small enough to go straight to full resolution
+	Image *in = source;
+	while (MAX(in->width,in->height) > PREVIEW_SIZE){
+		Image half;
+		img_half(&half,in);
+		if (in != source) image_free(in);
+		preview_source = half;
+		in = &preview_source;
+	}
+	preview_factor = (float)preview_source.width/source->width;
+}
+
+//0 if cancel cut it short
+static PreviewCacheEntry *get_preview(PipelineParams *params, Cancel *cancel){
+	PreviewCacheEntry *lru = preview_cache;
+	for (PreviewCacheEntry *e = preview_cache; e < preview_cache+PREVIEW_CACHE_SIZE; e++){
+		if (e->used && params_equal(&e->params,params)){
+			e->last_used = ++preview_clock;
+			return e;
+		}
+		if (e->last_used < lru->last_used) lru = e;
+	}
+	//the blur kernel and minimum rectangle size are in pixels, so scale them down with the image
+	PipelineParams scaled = *params;
+	scaled.gaussianBlurStrength = MAX(2,(int)(params->gaussianBlurStrength*preview_factor+0.5f));
+	scaled.rectangleDecomposeMinDim = MAX(1,(int)(params->rectangleDecomposeMinDim*preview_factor+0.5f));
+	lru->used = true;
+	lru->params = *params;
+	lru->last_used = ++preview_clock;
+	StageImage source = {.rgba = preview_source};
+	for (int i = 0; i < STAGE_COUNT; i++){
+		apply_stage(i,lru->stages+i,i ? lru->stages+i-1 : &source,&scaled,cancel);
+	}
+	if (cancelled(cancel)){
+		lru->used = false;
+		return 0;
+	}
+	return lru;
+}
+
+static void worker_main(void *arg){
+	Image source = {0};
+	PipelineParams params;
+	int dirty_from = STAGE_COUNT;//first stage whose full resolution output doesn't match the latest params
+	trace_thread_name("pipeline");
+	while (1){
+		mutex_lock(&job_mutex);
+		while (!job_pending && !quit) condvar_wait(&job_cond,&job_mutex);
+		if (quit){
+			mutex_unlock(&job_mutex);
+			break;
+		}
+		params = job_params;
+		dirty_from = MIN(dirty_from,job_first_stage);
+		char *source_path = job_source_path;
+		job_source_path = 0;
+		Cancel cancel = {&generation,generation};
+		job_pending = false;
+		mutex_unlock(&job_mutex);
+		arena_reset(scratch_arena());//per-update scope for the effects' temporaries
+		if (source_path){
+			image_free(&source);
+			load_image(&source,source_path);
+			free(source_path);
+		}
+		if (!source.pixels) continue;
+		if (source_path){
+			double t = trace_begin();
+			set_preview_source(&source);
+			trace_end("preview downscale",t);
+		}
+		if (preview_source.pixels){
+			double t = trace_begin();
+			PreviewCacheEntry *e = get_preview(&params,&cancel);
+			trace_end("preview",t);
+			if (cancelled(&cancel)) continue;//e is 0 if the preview was cut short
+			for (int i = dirty_from; i < STAGE_COUNT; i++){
+				StageImage *out = previews[i].images+previews[i].back;
+				stage_image_copy(out,e->stages+i);
+				out->generation = cancel.value;
+				out->source_width = source.width;
+				out->source_height = source.height;
+				publish(previews+i);
+				atomic_store_int(&stages[i].status,STAGE_PREVIEW);
+			}
+		}
+		//stages below dirty_from last published full resolution output, so their latest images are valid inputs
+		for (int i = dirty_from; i < STAGE_COUNT; i++){
+			if (cancelled(&cancel)) break;//superseded, the next job picks up from dirty_from
+			atomic_store_int(&stages[i].status,STAGE_RUNNING);
+			StageImage full_source = {.rgba = source};
+			StageImage *in = i ? stages[i-1].images+stages[i-1].latest : &full_source;
+			StageImage *out = stages[i].images+stages[i].back;
+			apply_stage(i,out,in,&params,&cancel);
+			out->generation = cancel.value;
+			out->source_width = source.width;
+			out->source_height = source.height;
+			double t = trace_begin();
+			stage_image_build_levels(out,&cancel);
+			trace_end("levels",t);
+			if (cancelled(&cancel)) break;//out was left unfinished
+			publish(stages+i);
+			atomic_store_int(&stages[i].status,STAGE_DONE);
+			dirty_from = i+1;
+		}
+	}
+	image_free(&source);
+	color_rects_free(&decomposed);
+	arena_report(scratch_arena());
+	arena_free(scratch_arena());
+}
+
+void pipeline_start(){
+	for (int i = 0; i < STAGE_COUNT; i++){
+		StageBuffer *buffers[] = {stages+i,previews+i};
+		for (int j = 0; j < COUNT(buffers); j++){
+			buffers[j]->back = 0;
+			buffers[j]->middle = 1;
+			buffers[j]->front = 2;
+			buffers[j]->latest = -1;
+		}
+	}
+	mutex_init(&job_mutex);
+	condvar_init(&job_cond);
+	thread_create(&worker,worker_main,0);
+}
+
+void pipeline_stop(){
+	mutex_lock(&job_mutex);
+	quit = true;
+	atomic_add_int(&generation,1);
+	condvar_broadcast(&job_cond);
+	mutex_unlock(&job_mutex);
+	thread_join(worker);
+}
+
+void pipeline_submit(PipelineParams *params, int first_stage, char *source_path){
+	mutex_lock(&job_mutex);
+	if (source_path){
+		free(job_source_path);
+		size_t len = strlen(source_path)+1;
+		job_source_path = malloc_or_die(len);
+		memcpy(job_source_path,source_path,len);
+		first_stage = STAGE_SOURCE;
+	}
+	job_params = *params;
+	job_first_stage = job_pending ? MIN(job_first_stage,first_stage) : first_stage;
+	job_pending = true;
+	atomic_add_int(&generation,1);
+	for (int i = first_stage; i < STAGE_COUNT; i++){
+		atomic_store_int(&stages[i].status,STAGE_QUEUED);
+	}
+	condvar_broadcast(&job_cond);
+	mutex_unlock(&job_mutex);
+}
+
+StageImage *pipeline_acquire(int stage, bool preview){
+	StageBuffer *sb = (preview ? previews : stages)+stage;
+	if (!(atomic_load_int(&sb->middle) & STAGE_BUFFER_FRESH)) return 0;
+	sb->front = atomic_exchange_int(&sb->middle,sb->front) & ~STAGE_BUFFER_FRESH;
+	return sb->images+sb->front;
+}
+
+int pipeline_stage_status(int stage){
+	return atomic_load_int(&stages[stage].status);
+}
+
+char *get_stage_name(int stage){
+	char *s = "unknown";
+	switch (stage){
+		case STAGE_SOURCE: s = "source"; break;
+		case STAGE_BLUR: s = "blur"; break;
+		case STAGE_QUANTIZE: s = "quantize"; break;
+		case STAGE_DECOMPOSE: s = "decompose"; break;
+		case STAGE_WORDS: s = "words"; break;
+	}
+	return s;
+}
\ No newline at end of file
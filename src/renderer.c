@@ -1,4 +1,8 @@
 #include <renderer.h>
+#include <image_effects.h>
+#include <text_measure.h>
+#include <trace.h>
+#include FT_ADVANCES_H
 
 GLenum glCheckError_(const char *file, int line){
 	GLenum errorCode;
@@ -16,23 +20,88 @@ GLenum glCheckError_(const char *file, int line){
 	return errorCode;
 }
 
+size_t upload_bytes;
+
 void texture_from_image(Texture *t, Image *i){
 	t->width = i->width;
 	t->height = i->height;
+	t->grey = false;
 	glGenTextures(1,&t->id);
 	glBindTexture(GL_TEXTURE_2D,t->id);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,i->stride);
 	glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,t->width,t->height,0,GL_RGBA,GL_UNSIGNED_BYTE,i->pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+	upload_bytes += (size_t)t->width*t->height*sizeof(*i->pixels);
+}
+
+static GLuint upload_pbo;//shared by every upload, orphaned each time so uploads don't serialize on it
+
+static void texture_upload_region(Texture *t, uint8_t *pixels, size_t pitch, int bytes_per_pixel, int x, int y, int width, int height){
+	bool grey = bytes_per_pixel == 1;
+	size_t row = (size_t)width*bytes_per_pixel;
+	size_t size = row*height;
+	upload_bytes += size;
+	if (!upload_pbo) glGenBuffers(1,&upload_pbo);
+	if (!t->id){
+		glGenTextures(1,&t->id);
+		glBindTexture(GL_TEXTURE_2D,t->id);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	} else {
+		glBindTexture(GL_TEXTURE_2D,t->id);
+	}
+	if (t->width != width || t->height != height || t->grey != grey){
+		t->width = width;
+		t->height = height;
+		t->grey = grey;
+		glTexImage2D(GL_TEXTURE_2D,0,grey ? GL_R8 : GL_RGBA,t->width,t->height,0,grey ? GL_RED : GL_RGBA,GL_UNSIGNED_BYTE,0);
+		GLint swizzle[4] = {GL_RED,grey ? GL_RED : GL_GREEN,grey ? GL_RED : GL_BLUE,grey ? GL_ONE : GL_ALPHA};
+		glTexParameteriv(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_RGBA,swizzle);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER,upload_pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER,size,0,GL_STREAM_DRAW);//orphan so we never wait on the previous upload
+	uint8_t *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,0,size,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!dst){
+		fatal_error("texture_update_from_region: failed to map pixel buffer");
+	}
+	uint8_t *src = pixels+(size_t)y*pitch+(size_t)x*bytes_per_pixel;//past INT_MAX after a few thousand rows of a 100k pixel wide image
+	if (row == pitch){
+		memcpy(dst,src,size);
+	} else {
+		for (int r = 0; r < height; r++){
+			memcpy(dst+(size_t)r*row,src+(size_t)r*pitch,row);
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	if (grey) glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexSubImage2D(GL_TEXTURE_2D,0,0,0,t->width,t->height,grey ? GL_RED : GL_RGBA,GL_UNSIGNED_BYTE,(void *)0);//sourced from the bound PBO, returns without waiting for the copy
+	if (grey) glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER,0);
+}
+
+void texture_update_from_region(Texture *t, Image *i, int x, int y, int width, int height){
+	texture_upload_region(t,(uint8_t *)i->pixels,(size_t)i->stride*sizeof(*i->pixels),sizeof(*i->pixels),x,y,width,height);
+}
+
+void texture_update_from_region8(Texture *t, Image8 *i, int x, int y, int width, int height){
+	texture_upload_region(t,i->pixels,i->stride,1,x,y,width,height);
+}
+
+void texture_update_from_image(Texture *t, Image *i){
+	texture_update_from_region(t,i,0,0,i->width,i->height);
 }
 
 void texture_from_file(Texture *t, char *path){
 	Image img;
 	load_image(&img,path);
 	texture_from_image(t,&img);
-	free(img.pixels);
+	image_free(&img);
 }
 
 void delete_texture(Texture *t){
@@ -127,10 +196,37 @@ struct TextureColorShader texture_color_shader = {
 	"}"
 };
 
-RoundedRectShader rounded_rect_shader = {
+struct SDFTextShader sdf_text_shader = {
 	"#version 330 core\n"
 	"in vec3 aPosition;\n"
-	"in vec4 aRectangle;\n"//xy: center, zw: half extents
+	"in vec2 aTexCoord;\n"
+	"in vec4 aColor;\n"
+	"uniform mat4 uMVP;\n"
+	"out vec2 vTexCoord;\n"
+	"out vec4 vColor;\n"
+	"void main(){\n"
+	"	gl_Position = uMVP * vec4(aPosition,1.0);\n"
+	"	vTexCoord = aTexCoord;\n"
+	"	vColor = aColor;\n"
+	"}",
+
+	"#version 330 core\n"
+	"uniform sampler2D uTex;\n"//single channel distance field, 0.5 on the outline
+	"in vec2 vTexCoord;\n"//texels, so quads appended before the atlas grew still point at their glyph
+	"in vec4 vColor;\n"
+	"out vec4 FragColor;\n"
+	"void main(){\n"
+	"	float d = texture(uTex,vTexCoord/vec2(textureSize(uTex,0))).r;\n"
+	"	float w = fwidth(d)*0.5;\n"//one screen pixel of antialiasing at any scale
+	"	FragColor = vec4(vColor.rgb,vColor.a*smoothstep(0.5-w,0.5+w,d));\n"
+	"}"
+};
+
+RoundedRectShader rounded_rect_shader = {
+	"#version 330 core\n"
+	"in vec2 aCorner;\n"//per vertex: unit quad corner in [-1,1]
+	"in vec4 aRectangle;\n"//per instance from here on. xy: center, zw: half extents
+	"in float aDepth;\n"
 	"in float aRoundingRadius;\n"
 	"in vec4 aColor;\n"
 	"in vec4 aIconColor;\n"
@@ -140,7 +236,8 @@ RoundedRectShader rounded_rect_shader = {
 	"out vec4 Color;\n"
 	"out vec4 IconColor;\n"
 	"void main(){\n"
-	"	gl_Position = proj * vec4(aPosition,1.0);\n"
+	"	vec2 p = aRectangle.xy + aCorner*(aRectangle.zw+4.0);\n"// pad by 4px to not cut off antialiased edges
+	"	gl_Position = proj * vec4(p,aDepth,1.0);\n"
 	"	Rectangle = aRectangle;\n"
 	"	RoundingRadius = aRoundingRadius;\n"
 	"	Color = aColor;\n"
@@ -250,10 +347,20 @@ static void compile_texture_color_shader(){
 	GET_UNIFORM(texture_color_shader,uTex);
 }
 
+static void compile_sdf_text_shader(){
+	COMPILE_SHADER(sdf_text_shader);
+	GET_ATTRIB(sdf_text_shader,aPosition);
+	GET_ATTRIB(sdf_text_shader,aTexCoord);
+	GET_ATTRIB(sdf_text_shader,aColor);
+	GET_UNIFORM(sdf_text_shader,uMVP);
+	GET_UNIFORM(sdf_text_shader,uTex);
+}
+
 static void compile_rounded_rect_shader(){
 	COMPILE_SHADER(rounded_rect_shader);
-	GET_ATTRIB(rounded_rect_shader,aPosition);
+	GET_ATTRIB(rounded_rect_shader,aCorner);
 	GET_ATTRIB(rounded_rect_shader,aRectangle);
+	GET_ATTRIB(rounded_rect_shader,aDepth);
 	GET_ATTRIB(rounded_rect_shader,aRoundingRadius);
 	GET_ATTRIB(rounded_rect_shader,aColor);
 	GET_ATTRIB(rounded_rect_shader,aIconColor);
@@ -263,67 +370,20 @@ static void compile_rounded_rect_shader(){
 void compile_shaders(){
 	compile_color_shader();
 	compile_texture_color_shader();
+	compile_sdf_text_shader();
 	compile_rounded_rect_shader();
 }
 
-TextureColorVertex *TextureColorVertexListMakeRoom(TextureColorVertexList *list, int count){
-	if (list->used+count > list->total){
-		if (!list->total) list->total = 1;
-		while (list->used+count > list->total) list->total *= 2;
-		list->elements = realloc_or_die(list->elements,list->total*sizeof(*list->elements));
-	}
-	list->used += count;
-	return list->elements+list->used-count;
-}
-
-RoundedRectVertex *RoundedRectVertexListMakeRoom(RoundedRectVertexList *list, int count){
-	if (list->used+count > list->total){
-		if (!list->total) list->total = 1;
-		while (list->used+count > list->total) list->total *= 2;
-		list->elements = realloc_or_die(list->elements,list->total*sizeof(*list->elements));
-	}
-	list->used += count;
-	return list->elements+list->used-count;
-}
-
-void append_rounded_rect(RoundedRectVertexList *verts, int x, int y, int z, int halfWidth, int halfHeight, float RoundingRadius, uint32_t color, uint32_t IconColor){
-	RoundedRectVertex *v = RoundedRectVertexListMakeRoom(verts,6);
-	int hwp = halfWidth+4;// pad by 4px to not cut off antialiased edges
-	int hhp = halfHeight+4;
-
-	v[0].Position[0] = -hwp + x;
-	v[0].Position[1] = hhp + y;
-	v[0].Position[2] = z;
-
-	v[1].Position[0] = -hwp + x;
-	v[1].Position[1] = -hhp + y;
-	v[1].Position[2] = z;
-
-	v[2].Position[0] = hwp + x;
-	v[2].Position[1] = -hhp + y;
-	v[2].Position[2] = z;
-
-	v[3].Position[0] = v[2].Position[0];
-	v[3].Position[1] = v[2].Position[1];
-	v[3].Position[2] = v[2].Position[2];
-
-	v[4].Position[0] = hwp + x;
-	v[4].Position[1] = hhp + y;
-	v[4].Position[2] = z;
-
-	v[5].Position[0] = v[0].Position[0];
-	v[5].Position[1] = v[0].Position[1];
-	v[5].Position[2] = v[0].Position[2];
-
-	for (int i = 0; i < 6; i++){
-		v[i].Rectangle[0] = x;
-		v[i].Rectangle[1] = y;
-		v[i].Rectangle[2] = halfWidth;
-		v[i].Rectangle[3] = halfHeight;
-		v[i].RoundingRadius = RoundingRadius;
-		v[i].color = color;
-		v[i].IconColor = IconColor;
-	}
+void append_rounded_rect(RoundedRectInstanceList *instances, int x, int y, int z, int halfWidth, int halfHeight, float RoundingRadius, uint32_t color, uint32_t IconColor){
+	RoundedRectInstance *r = RoundedRectInstanceListMakeRoom(instances,1);
+	r->Rectangle[0] = x;
+	r->Rectangle[1] = y;
+	r->Rectangle[2] = halfWidth;
+	r->Rectangle[3] = halfHeight;
+	r->Depth = z;
+	r->RoundingRadius = RoundingRadius;
+	r->color = color;
+	r->IconColor = IconColor;
 }
 
 void new_vao(GPUMesh *m, void *verts, int count, size_t size_of_element){
@@ -353,18 +413,50 @@ void gpu_mesh_from_texture_color_verts(GPUMesh *m, TextureColorVertex *verts, in
 	glVertexAttribPointer(texture_color_shader.aColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(TextureColorVertex),(void *)offsetof(TextureColorVertex,color));
 }
 
-void gpu_mesh_from_rounded_rect_verts(GPUMesh *m, RoundedRectVertex *verts, int count){
+void gpu_mesh_from_sdf_text_verts(GPUMesh *m, TextureColorVertex *verts, int count){
 	new_vao(m,verts,count,sizeof(*verts));
-	glEnableVertexAttribArray(rounded_rect_shader.aPosition);
+	glEnableVertexAttribArray(sdf_text_shader.aPosition);
+	glEnableVertexAttribArray(sdf_text_shader.aTexCoord);
+	glEnableVertexAttribArray(sdf_text_shader.aColor);
+	glVertexAttribPointer(sdf_text_shader.aPosition,3,GL_FLOAT,GL_FALSE,sizeof(TextureColorVertex),(void *)0);
+	glVertexAttribPointer(sdf_text_shader.aTexCoord,2,GL_FLOAT,GL_FALSE,sizeof(TextureColorVertex),(void *)offsetof(TextureColorVertex,texcoord));
+	glVertexAttribPointer(sdf_text_shader.aColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(TextureColorVertex),(void *)offsetof(TextureColorVertex,color));
+}
+
+void rounded_rect_batch_init(RoundedRectBatch *b){
+	float corners[6][2] = {{-1,1},{-1,-1},{1,-1},{1,-1},{1,1},{-1,1}};
+	glGenVertexArrays(1,&b->vao);
+	glBindVertexArray(b->vao);
+	glGenBuffers(1,&b->quad_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER,b->quad_vbo);
+	glBufferData(GL_ARRAY_BUFFER,sizeof(corners),corners,GL_STATIC_DRAW);
+	glEnableVertexAttribArray(rounded_rect_shader.aCorner);
+	glVertexAttribPointer(rounded_rect_shader.aCorner,2,GL_FLOAT,GL_FALSE,sizeof(*corners),(void *)0);
+	glGenBuffers(1,&b->instance_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER,b->instance_vbo);
 	glEnableVertexAttribArray(rounded_rect_shader.aRectangle);
+	glEnableVertexAttribArray(rounded_rect_shader.aDepth);
 	glEnableVertexAttribArray(rounded_rect_shader.aRoundingRadius);
 	glEnableVertexAttribArray(rounded_rect_shader.aColor);
 	glEnableVertexAttribArray(rounded_rect_shader.aIconColor);
-	glVertexAttribPointer(rounded_rect_shader.aPosition,3,GL_FLOAT,GL_FALSE,sizeof(RoundedRectVertex),(void *)0);
-	glVertexAttribPointer(rounded_rect_shader.aRectangle,4,GL_FLOAT,GL_FALSE,sizeof(RoundedRectVertex),(void *)offsetof(RoundedRectVertex,Rectangle));
-	glVertexAttribPointer(rounded_rect_shader.aRoundingRadius,1,GL_FLOAT,GL_FALSE,sizeof(RoundedRectVertex),(void *)offsetof(RoundedRectVertex,RoundingRadius));
-	glVertexAttribPointer(rounded_rect_shader.aColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(RoundedRectVertex),(void *)offsetof(RoundedRectVertex,color));
-	glVertexAttribPointer(rounded_rect_shader.aIconColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(RoundedRectVertex),(void *)offsetof(RoundedRectVertex,IconColor));
+	glVertexAttribPointer(rounded_rect_shader.aRectangle,4,GL_FLOAT,GL_FALSE,sizeof(RoundedRectInstance),(void *)0);
+	glVertexAttribPointer(rounded_rect_shader.aDepth,1,GL_FLOAT,GL_FALSE,sizeof(RoundedRectInstance),(void *)offsetof(RoundedRectInstance,Depth));
+	glVertexAttribPointer(rounded_rect_shader.aRoundingRadius,1,GL_FLOAT,GL_FALSE,sizeof(RoundedRectInstance),(void *)offsetof(RoundedRectInstance,RoundingRadius));
+	glVertexAttribPointer(rounded_rect_shader.aColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(RoundedRectInstance),(void *)offsetof(RoundedRectInstance,color));
+	glVertexAttribPointer(rounded_rect_shader.aIconColor,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(RoundedRectInstance),(void *)offsetof(RoundedRectInstance,IconColor));
+	glVertexAttribDivisor(rounded_rect_shader.aRectangle,1);
+	glVertexAttribDivisor(rounded_rect_shader.aDepth,1);
+	glVertexAttribDivisor(rounded_rect_shader.aRoundingRadius,1);
+	glVertexAttribDivisor(rounded_rect_shader.aColor,1);
+	glVertexAttribDivisor(rounded_rect_shader.aIconColor,1);
+}
+
+void draw_rounded_rect_batch(RoundedRectBatch *b, RoundedRectInstance *instances, int count){
+	if (!count) return;
+	glBindVertexArray(b->vao);
+	glBindBuffer(GL_ARRAY_BUFFER,b->instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER,count*sizeof(*instances),instances,GL_STREAM_DRAW);
+	glDrawArraysInstanced(GL_TRIANGLES,0,6,count);
 }
 
 void delete_gpu_mesh(GPUMesh *m){
@@ -375,42 +467,336 @@ void delete_gpu_mesh(GPUMesh *m){
 	m->vertex_count = 0;
 }
 
-void new_image(Image *i, int width, int height){
-	i->width = width;
-	i->height = height;
-	i->pixels = zalloc_or_die(width*height*sizeof(*i->pixels));
-}
-
-void blit_8_to_32(Image8 *src, int sx, int sy, int swidth, int sheight, Image *dst, int dx, int dy, uint32_t color){
-	if (dx >= dst->width || dy >= dst->height) return;
-	if (dx < 0){
-		sx -= dx;
-		swidth += dx;
-		if (swidth < 1) return;
-		dx = 0;
+static GPUMesh tile_quad;
+
+static int max_texture_size(){
+	static GLint size;
+	if (!size) glGetIntegerv(GL_MAX_TEXTURE_SIZE,&size);
+	return size;
+}
+
+//frees pixels built here and forgets aliased ones, keeping the size
+static void release_level_pixels(TiledTextureLevel *level){
+	if (level->built){
+		image_free(&level->image);
+		image8_free(&level->grey);
+		level->built = false;
+	} else {
+		level->image.pixels = 0;
+		level->grey.pixels = 0;
 	}
-	if (dx+swidth > dst->width){
-		swidth -= (dx+swidth)-dst->width;
-		if (swidth < 1) return;
+}
+
+static void free_tiled_texture_levels(TiledTexture *t){
+	for (int l = 0; l < t->level_count; l++){
+		TiledTextureLevel *level = t->levels+l;
+		for (int i = 0; i < level->columns*level->rows; i++){
+			if (level->tiles[i].texture.id) delete_texture(&level->tiles[i].texture);
+		}
+		free(level->tiles);
+		release_level_pixels(level);
 	}
-	if (dy < 0){
-		sy -= dy;
-		sheight += dy;
-		if (sheight < 1) return;
-		dy = 0;
+	memset(t->levels,0,sizeof(t->levels));
+	t->level_count = 0;
+}
+
+//keeps the tiles if the size and format match, otherwise rebuilds the level chain
+static void tiled_texture_set_size(TiledTexture *t, int width, int height, bool grey){
+	if (t->level_count && t->levels[0].image.width == width && t->levels[0].image.height == height && t->grey == grey){
+		for (int l = 0; l < t->level_count; l++){
+			TiledTextureLevel *level = t->levels+l;
+			for (int j = 0; j < level->columns*level->rows; j++){
+				level->tiles[j].stale = true;
+			}
+			release_level_pixels(level);
+		}
+		return;
 	}
-	if (dy+sheight > dst->height){
-		sheight -= (dy+sheight)-dst->height;
-		if (sheight < 1) return;
+	free_tiled_texture_levels(t);
+	t->grey = grey;
+	t->tile_size = MIN(TILE_SIZE,max_texture_size());
+	int w = width, h = height;
+	while (1){
+		TiledTextureLevel *level = t->levels+t->level_count++;
+		level->image.width = w;
+		level->image.height = h;
+		level->columns = (w+t->tile_size-1)/t->tile_size;
+		level->rows = (h+t->tile_size-1)/t->tile_size;
+		level->tiles = zalloc_or_die(level->columns*level->rows*sizeof(*level->tiles));
+		if ((w <= t->tile_size && h <= t->tile_size) || t->level_count == COUNT(t->levels)) break;
+		w = MAX(1,w/2);
+		h = MAX(1,h/2);
 	}
-	for (int i = 0; i < sheight; i++){
-		for (int j = 0; j < swidth; j++){
-			dst->pixels[(dy+i)*dst->width+dx+j] = (src->pixels[(sy+i)*src->width+sx+j]<<24) | color;
+}
+
+void tiled_texture_set_image(TiledTexture *t, Image *i, Image *levels, int level_count){
+	tiled_texture_set_size(t,i->width,i->height,false);
+	t->levels[0].image = *i;
+	for (int l = 1; l < t->level_count && l <= level_count; l++){
+		TiledTextureLevel *level = t->levels+l;
+		if (levels[l-1].width != level->image.width || levels[l-1].height != level->image.height) break;
+		level->image = levels[l-1];
+	}
+}
+
+void tiled_texture_set_image8(TiledTexture *t, Image8 *i, Image8 *levels, int level_count){
+	tiled_texture_set_size(t,i->width,i->height,true);
+	t->levels[0].grey = *i;
+	for (int l = 1; l < t->level_count && l <= level_count; l++){
+		TiledTextureLevel *level = t->levels+l;
+		if (levels[l-1].width != level->image.width || levels[l-1].height != level->image.height) break;
+		level->grey = levels[l-1];
+	}
+}
+
+void delete_tiled_texture(TiledTexture *t){
+	free_tiled_texture_levels(t);
+}
+
+static Image *get_level_image(TiledTexture *t, int l){
+	TiledTextureLevel *level = t->levels+l;
+	if (!level->image.pixels){
+		img_half(&level->image,get_level_image(t,l-1));
+		level->built = true;
+	}
+	return &level->image;
+}
+
+static Image8 *get_level_image8(TiledTexture *t, int l){
+	TiledTextureLevel *level = t->levels+l;
+	if (!level->grey.pixels){
+		img8_half(&level->grey,get_level_image8(t,l-1));
+		level->built = true;
+	}
+	return &level->grey;
+}
+
+void draw_tiled_texture(TiledTexture *t, mat4 proj, float x, float y, float z, float width, float height, int viewport_width, int viewport_height, int frame){
+	if (!t->level_count || width < 1 || height < 1) return;
+	if (!tile_quad.vao){
+		TextureColorVertex v[6] = {
+			{{0,1,0},{0,0},RGBA(255,255,255,255)},
+			{{0,0,0},{0,1},RGBA(255,255,255,255)},
+			{{1,0,0},{1,1},RGBA(255,255,255,255)},
+			{{1,0,0},{1,1},RGBA(255,255,255,255)},
+			{{1,1,0},{1,0},RGBA(255,255,255,255)},
+			{{0,1,0},{0,0},RGBA(255,255,255,255)}
+		};
+		gpu_mesh_from_texture_color_verts(&tile_quad,v,COUNT(v));
+	}
+	//pick the coarsest level that still has at least one texel per screen pixel, the tile mip chains cover the rest
+	int l = 0;
+	while (l+1 < t->level_count && t->levels[l+1].image.width >= width && t->levels[l+1].image.height >= height) l++;
+	TiledTextureLevel *level = t->levels+l;
+	Image *img = &level->image;
+	float sx = width/img->width;
+	float sy = height/img->height;
+	//visible tile range, y is flipped because row 0 of the image is drawn at the top
+	int c0 = MAX(0,(int)(-x/sx)/t->tile_size);
+	int c1 = MIN(level->columns-1,(int)((viewport_width-x)/sx)/t->tile_size);
+	int r0 = MAX(0,(int)((y+height-viewport_height)/sy)/t->tile_size);
+	int r1 = MIN(level->rows-1,(int)((y+height)/sy)/t->tile_size);
+	glBindVertexArray(tile_quad.vao);
+	for (int r = r0; r <= r1; r++){
+		for (int c = c0; c <= c1; c++){
+			TextureTile *tile = level->tiles+r*level->columns+c;
+			int tx = c*t->tile_size;
+			int ty = r*t->tile_size;
+			int tw = MIN(t->tile_size,img->width-tx);
+			int th = MIN(t->tile_size,img->height-ty);
+			if (!tile->texture.id || tile->stale){
+				double trace_start = trace_begin();
+				if (t->grey){
+					texture_update_from_region8(&tile->texture,get_level_image8(t,l),tx,ty,tw,th);
+				} else {
+					texture_update_from_region(&tile->texture,get_level_image(t,l),tx,ty,tw,th);
+				}
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+				glGenerateMipmap(GL_TEXTURE_2D);
+				tile->stale = false;
+				trace_end("tile upload",trace_start);
+			} else {
+				glBindTexture(GL_TEXTURE_2D,tile->texture.id);
+			}
+			tile->last_used = frame;
+			mat4 mata,matb,matc;
+			glm_scale_make(matb,(vec3){tw*sx,th*sy,1});
+			glm_translate_make(mata,(vec3){x+tx*sx,y+height-(ty+th)*sy,z});
+			glm_mat4_mul(mata,matb,matc);
+			glm_mat4_mul(proj,matc,mata);
+			glUniformMatrix4fv(texture_color_shader.uMVP,1,GL_FALSE,(GLfloat *)mata);
+			glDrawArrays(GL_TRIANGLES,0,tile_quad.vertex_count);
+		}
+	}
+	//drop tiles that haven't been on screen for a while so zooming around doesn't pin every level in vram
+	for (int i = 0; i < t->level_count; i++){
+		TiledTextureLevel *lv = t->levels+i;
+		for (int j = 0; j < lv->columns*lv->rows; j++){
+			TextureTile *tile = lv->tiles+j;
+			if (tile->texture.id && frame-tile->last_used > TILE_EVICT_FRAMES) delete_texture(&tile->texture);
 		}
 	}
 }
 
+void new_image(Image *i, int width, int height){
+	image_alloc(i,width,height);
+	image_clear(i);
+}
+
+static uint8_t div255(int x){
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static void blend_span_scalar(uint32_t *dst, uint8_t *coverage, int count, uint32_t color, int opacity){
+	uint8_t *c = (uint8_t *)&color;
+	for (int i = 0; i < count; i++){
+		int a = opacity == 255 ? coverage[i] : div255(coverage[i]*opacity);
+		if (!a) continue;
+		if (a == 255){
+			dst[i] = color | 0xff000000;
+			continue;
+		}
+		uint8_t *d = (uint8_t *)(dst+i);
+		for (int j = 0; j < 3; j++){
+			d[j] = div255(c[j]*a) + div255(d[j]*(255-a));
+		}
+		d[3] = a + div255(d[3]*(255-a));
+	}
+}
+
+#ifdef BLEND_SSE2
+static __m128i div255_epi16(__m128i x){
+	x = _mm_add_epi16(x,_mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x,_mm_srli_epi16(x,8)),8);
+}
+
+//a holds each pixel's coverage in all 4 of its bytes, c16 is r,g,b,255 widened to 16 bits twice
+static void blend4_sse2(uint32_t *dst, __m128i a, __m128i c16){
+	__m128i zero = _mm_setzero_si128();
+	__m128i max16 = _mm_set1_epi16(255);
+	__m128i d = _mm_loadu_si128((__m128i *)dst);
+	__m128i alo = _mm_unpacklo_epi8(a,zero);
+	__m128i ahi = _mm_unpackhi_epi8(a,zero);
+	__m128i dlo = _mm_unpacklo_epi8(d,zero);
+	__m128i dhi = _mm_unpackhi_epi8(d,zero);
+	dlo = _mm_add_epi16(div255_epi16(_mm_mullo_epi16(c16,alo)),div255_epi16(_mm_mullo_epi16(dlo,_mm_sub_epi16(max16,alo))));
+	dhi = _mm_add_epi16(div255_epi16(_mm_mullo_epi16(c16,ahi)),div255_epi16(_mm_mullo_epi16(dhi,_mm_sub_epi16(max16,ahi))));
+	_mm_storeu_si128((__m128i *)dst,_mm_packus_epi16(dlo,dhi));
+}
+
+//blends 16 pixels from 16 coverage bytes
+static void blend16_sse2(uint32_t *dst, __m128i cov, __m128i c16){
+	__m128i lo = _mm_unpacklo_epi8(cov,cov);
+	__m128i hi = _mm_unpackhi_epi8(cov,cov);
+	blend4_sse2(dst,_mm_unpacklo_epi16(lo,lo),c16);
+	blend4_sse2(dst+4,_mm_unpackhi_epi16(lo,lo),c16);
+	blend4_sse2(dst+8,_mm_unpacklo_epi16(hi,hi),c16);
+	blend4_sse2(dst+12,_mm_unpackhi_epi16(hi,hi),c16);
+}
+#endif
+
+#ifdef BLEND_AVX2
+static __m256i div255_epi16_avx2(__m256i x){
+	x = _mm256_add_epi16(x,_mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x,_mm256_srli_epi16(x,8)),8);
+}
+
+//blends 8 pixels. Unpacks work per 128 bit lane, so pixels 0-3 stay in the low lane and 4-7 in the high one throughout.
+static void blend8_avx2(uint32_t *dst, uint8_t *coverage, __m256i c16){
+	__m256i zero = _mm256_setzero_si256();
+	__m256i max16 = _mm256_set1_epi16(255);
+	__m128i c = _mm_loadl_epi64((__m128i *)coverage);
+	c = _mm_unpacklo_epi8(c,c);
+	__m256i a = _mm256_set_m128i(_mm_unpackhi_epi16(c,c),_mm_unpacklo_epi16(c,c));
+	__m256i d = _mm256_loadu_si256((__m256i *)dst);
+	__m256i alo = _mm256_unpacklo_epi8(a,zero);
+	__m256i ahi = _mm256_unpackhi_epi8(a,zero);
+	__m256i dlo = _mm256_unpacklo_epi8(d,zero);
+	__m256i dhi = _mm256_unpackhi_epi8(d,zero);
+	dlo = _mm256_add_epi16(div255_epi16_avx2(_mm256_mullo_epi16(c16,alo)),div255_epi16_avx2(_mm256_mullo_epi16(dlo,_mm256_sub_epi16(max16,alo))));
+	dhi = _mm256_add_epi16(div255_epi16_avx2(_mm256_mullo_epi16(c16,ahi)),div255_epi16_avx2(_mm256_mullo_epi16(dhi,_mm256_sub_epi16(max16,ahi))));
+	_mm256_storeu_si256((__m256i *)dst,_mm256_packus_epi16(dlo,dhi));
+}
+#endif
+
+void blend_span_over(uint32_t *dst, uint8_t *coverage, int count, uint32_t color){
+	int i = 0;
+	uint32_t solid = color | 0xff000000;
+#ifdef BLEND_AVX2
+	__m256i solid256 = _mm256_set1_epi32(solid);
+	__m256i c16x = _mm256_unpacklo_epi8(solid256,_mm256_setzero_si256());
+	for (; i+32 <= count; i += 32){
+		__m256i cov = _mm256_loadu_si256((__m256i *)(coverage+i));
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cov,_mm256_setzero_si256())) == 0xffffffff) continue;
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cov,_mm256_set1_epi8(-1))) == 0xffffffff){
+			for (int j = 0; j < 32; j += 8) _mm256_storeu_si256((__m256i *)(dst+i+j),solid256);
+			continue;
+		}
+		for (int j = 0; j < 32; j += 8) blend8_avx2(dst+i+j,coverage+i+j,c16x);
+	}
+#endif
+#ifdef BLEND_SSE2
+	__m128i solid128 = _mm_set1_epi32(solid);
+	__m128i c16 = _mm_unpacklo_epi8(solid128,_mm_setzero_si128());
+	for (; i+16 <= count; i += 16){
+		__m128i cov = _mm_loadu_si128((__m128i *)(coverage+i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(cov,_mm_setzero_si128())) == 0xffff) continue;//glyph bitmaps are mostly empty or solid
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(cov,_mm_set1_epi8(-1))) == 0xffff){
+			for (int j = 0; j < 16; j += 4) _mm_storeu_si128((__m128i *)(dst+i+j),solid128);
+			continue;
+		}
+		blend16_sse2(dst+i,cov,c16);
+	}
+	for (; i+4 <= count; i += 4){
+		uint32_t cov4;
+		memcpy(&cov4,coverage+i,4);
+		if (!cov4) continue;
+		__m128i a = _mm_cvtsi32_si128(cov4);
+		a = _mm_unpacklo_epi8(a,a);
+		blend4_sse2(dst+i,_mm_unpacklo_epi16(a,a),c16);
+	}
+#endif
+	blend_span_scalar(dst+i,coverage+i,count-i,color,255);
+}
+
+void blend_span_over_tinted(uint32_t *dst, uint8_t *coverage, int count, uint32_t color){
+	int opacity = color >> 24;
+	if (opacity == 255){
+		blend_span_over(dst,coverage,count,color);
+		return;
+	}
+	if (!opacity) return;
+	int i = 0;
+#ifdef BLEND_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i c16 = _mm_unpacklo_epi8(_mm_set1_epi32(color | 0xff000000),zero);
+	__m128i o16 = _mm_set1_epi16(opacity);
+	for (; i+16 <= count; i += 16){
+		__m128i cov = _mm_loadu_si128((__m128i *)(coverage+i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(cov,zero)) == 0xffff) continue;
+		__m128i lo = div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(cov,zero),o16));
+		__m128i hi = div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(cov,zero),o16));
+		blend16_sse2(dst+i,_mm_packus_epi16(lo,hi),c16);
+	}
+#endif
+	blend_span_scalar(dst+i,coverage+i,count-i,color,opacity);
+}
+
+void blit_8_to_32(Image8 *src, Image *dst, int dx, int dy, uint32_t color){
+	int x0 = MAX(0,dx), y0 = MAX(0,dy);
+	int x1 = MIN(dst->width,dx+src->width), y1 = MIN(dst->height,dy+src->height);
+	if (x0 >= x1 || y0 >= y1) return;
+	void (*span)(uint32_t *, uint8_t *, int, uint32_t) = (color >> 24) == 255 ? blend_span_over : blend_span_over_tinted;
+	for (int y = y0; y < y1; y++){
+		span(image_row(dst,y)+x0,image8_row(src,y-dy)+x0-dx,x1-x0,color);
+	}
+}
+
 void draw_string(Image *dst, int x, int y, FT_Face font_face, int font_height, uint32_t color, int char_count, char *string){
+	double t = trace_begin();
 	if (FT_Set_Pixel_Sizes(font_face,0,font_height)){
 		fatal_error("Failed to set freetype char size.");
 	}
@@ -421,40 +807,53 @@ void draw_string(Image *dst, int x, int y, FT_Face font_face, int font_height, u
 		Image8 glyph_image = {
 			.width = font_face->glyph->bitmap.width,
 			.height = font_face->glyph->bitmap.rows,
+			.stride = font_face->glyph->bitmap.pitch,
 			.pixels = font_face->glyph->bitmap.buffer
 		};
-		blit_8_to_32(&glyph_image,0,0,glyph_image.width,glyph_image.height,dst,x+font_face->glyph->bitmap_left,y-font_face->glyph->bitmap_top,color & 0xffffff);
+		blit_8_to_32(&glyph_image,dst,x+font_face->glyph->bitmap_left,y-font_face->glyph->bitmap_top,color);
 		x += font_face->glyph->advance.x >> 6;
 	}
+	trace_end("draw_string",t);
 }
 
 void draw_string_centered(Image *dst, int x, int y, FT_Face font_face, int font_height, uint32_t color, int char_count, char *string){
+	TextMetrics m, nine;
+	measure_string(&m,font_face,font_height,char_count,string);
+	measure_string(&nine,font_face,font_height,1,"9");
 	if (FT_Set_Pixel_Sizes(font_face,0,font_height)){
 		fatal_error("Failed to set freetype char size.");
 	}
-	int width = 0;
-	for (int i = 0; i < char_count; i++){
-		if (FT_Load_Char(font_face,string[i],FT_LOAD_RENDER)){
-			fatal_error("Failed to load freetype glyph");
-		}
-		width += font_face->glyph->advance.x >> 6;
-	}
-	if (FT_Load_Char(font_face,'9',FT_LOAD_RENDER)){
-		fatal_error("Failed to load freetype glyph");
-	}
-	int max_height = font_face->glyph->bitmap.rows;
-	x -= (float)width / 2;
+	//the pen moves exactly as measure_string counts (hinted whole pixels up to MEASURE_HINTED_MAX_SIZE, scaled font units above, kerned either way), so the measured ink bounds are where the ink lands
+	bool hinted = font_height <= MEASURE_HINTED_MAX_SIZE;
+	float scale = (float)font_height/font_face->units_per_EM;
+	float pen = x-(m.left+m.right)/2;
+	int max_height = nine.bottom - nine.top;
 	y += (float)max_height / 2;
+	FT_UInt prev = 0;
 	for (int i = 0; i < char_count; i++){
-		if (FT_Load_Char(font_face,string[i],FT_LOAD_RENDER)){
+		FT_UInt glyph = FT_Get_Char_Index(font_face,(unsigned char)string[i]);
+		if (prev && glyph && FT_HAS_KERNING(font_face)){
+			FT_Vector k;
+			FT_Get_Kerning(font_face,prev,glyph,hinted ? FT_KERNING_DEFAULT : FT_KERNING_UNSCALED,&k);
+			pen += hinted ? k.x/64.0f : k.x*scale;
+		}
+		prev = glyph;
+		if (FT_Load_Glyph(font_face,glyph,FT_LOAD_RENDER)){
 			fatal_error("Failed to load freetype glyph");
 		}
 		Image8 glyph_image = {
 			.width = font_face->glyph->bitmap.width,
 			.height = font_face->glyph->bitmap.rows,
+			.stride = font_face->glyph->bitmap.pitch,
 			.pixels = font_face->glyph->bitmap.buffer
 		};
-		blit_8_to_32(&glyph_image,0,0,glyph_image.width,glyph_image.height,dst,x+font_face->glyph->bitmap_left,y-font_face->glyph->bitmap_top,color & 0xffffff);
-		x += font_face->glyph->advance.x >> 6;
+		blit_8_to_32(&glyph_image,dst,(int)floorf(pen+0.5f)+font_face->glyph->bitmap_left,y-font_face->glyph->bitmap_top,color);
+		if (hinted){
+			pen += font_face->glyph->advance.x >> 6;
+		} else {
+			FT_Fixed advance;
+			FT_Get_Advance(font_face,glyph,FT_LOAD_NO_SCALE,&advance);
+			pen += advance*scale;
+		}
 	}
 }
\ No newline at end of file
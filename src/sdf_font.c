@@ -0,0 +1,210 @@
+#include <sdf_font.h>
+#include <trace.h>
+
+#define EDT_INF 1e20f
+
+/*
+edt_1d
+Felzenszwalb & Huttenlocher's linear time 1D squared Euclidean distance
+transform: d[q] = min over p of (q-p)^2 + f[p]. v and z are scratch.
+*/
+static void edt_1d(float *f, int n, float *d, int *v, float *z){
+	int k = 0;
+	v[0] = 0;
+	z[0] = -EDT_INF;
+	z[1] = EDT_INF;
+	for (int q = 1; q < n; q++){
+		float s = ((f[q]+q*q)-(f[v[k]]+v[k]*v[k]))/(2.0f*q-2.0f*v[k]);
+		while (s <= z[k]){
+			k--;
+			s = ((f[q]+q*q)-(f[v[k]]+v[k]*v[k]))/(2.0f*q-2.0f*v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = EDT_INF;
+	}
+	k = 0;
+	for (int q = 0; q < n; q++){
+		while (z[k+1] < q) k++;
+		d[q] = (q-v[k])*(q-v[k])+f[v[k]];
+	}
+}
+
+//squared distance from every cell to the nearest cell that's 0 in grid, done in place
+static void edt_2d(float *grid, int width, int height){
+	int n = MAX(width,height);
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	float *f = arena_alloc(scratch,n*sizeof(*f));
+	float *d = arena_alloc(scratch,n*sizeof(*d));
+	float *z = arena_alloc(scratch,(n+1)*sizeof(*z));
+	int *v = arena_alloc(scratch,n*sizeof(*v));
+	for (int x = 0; x < width; x++){
+		for (int y = 0; y < height; y++) f[y] = grid[y*width+x];
+		edt_1d(f,height,d,v,z);
+		for (int y = 0; y < height; y++) grid[y*width+x] = d[y];
+	}
+	for (int y = 0; y < height; y++){
+		memcpy(f,grid+y*width,width*sizeof(*f));
+		edt_1d(f,width,grid+y*width,v,z);
+	}
+	arena_release(scratch,mark);
+}
+
+//returns false if the atlas is already as large as a texture can be
+static bool atlas_alloc(SDFFont *f, SDFGlyph *g){
+	if (f->shelf_x+g->width > f->atlas.width){
+		f->shelf_x = 0;
+		f->shelf_y += f->shelf_height;
+		f->shelf_height = 0;
+	}
+	if (f->shelf_y+g->height > f->atlas.height){
+		if (f->atlas.height*2 > f->max_height) return false;
+		Image8 grown;
+		image8_alloc(&grown,f->atlas.width,f->atlas.height*2);
+		Image8 top = image8_view(&grown,0,0,f->atlas.width,f->atlas.height);
+		Image8 bottom = image8_view(&grown,0,f->atlas.height,f->atlas.width,f->atlas.height);
+		image8_copy(&top,&f->atlas);
+		image8_clear(&bottom);
+		image8_free(&f->atlas);
+		f->atlas = grown;
+	}
+	g->x = f->shelf_x;
+	g->y = f->shelf_y;
+	f->shelf_x += g->width;
+	f->shelf_height = MAX(f->shelf_height,g->height);
+	return true;
+}
+
+static void generate_glyph(SDFFont *f, unsigned char c, SDFGlyph *g){
+	if (FT_Load_Char(f->face,c,FT_LOAD_RENDER)){
+		fatal_error("Failed to load freetype glyph");
+	}
+	FT_GlyphSlot slot = f->face->glyph;
+	g->loaded = true;
+	g->advance = (float)(slot->advance.x >> 6)/SDF_SUPERSAMPLE;
+	g->left = (float)slot->bitmap_left/SDF_SUPERSAMPLE-SDF_SPREAD;
+	g->top = (float)slot->bitmap_top/SDF_SUPERSAMPLE+SDF_SPREAD;
+	int bw = slot->bitmap.width, bh = slot->bitmap.rows;
+	if (!bw || !bh){
+		g->width = g->height = 0;
+		return;
+	}
+	//pad the supersampled bitmap by the spread so distances outside the ink are measured too
+	int pad = SDF_SPREAD*SDF_SUPERSAMPLE;
+	int cw = (bw+SDF_SUPERSAMPLE-1)/SDF_SUPERSAMPLE, ch = (bh+SDF_SUPERSAMPLE-1)/SDF_SUPERSAMPLE;
+	int gw = cw*SDF_SUPERSAMPLE+2*pad, gh = ch*SDF_SUPERSAMPLE+2*pad;
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	float *outside = arena_alloc(scratch,gw*gh*sizeof(*outside));
+	float *inside = arena_alloc(scratch,gw*gh*sizeof(*inside));
+	for (int y = 0; y < gh; y++){
+		for (int x = 0; x < gw; x++){
+			int bx = x-pad, by = y-pad;
+			bool in = bx >= 0 && by >= 0 && bx < bw && by < bh && slot->bitmap.buffer[by*slot->bitmap.pitch+bx] >= 128;
+			outside[y*gw+x] = in ? 0 : EDT_INF;
+			inside[y*gw+x] = in ? EDT_INF : 0;
+		}
+	}
+	edt_2d(outside,gw,gh);
+	edt_2d(inside,gw,gh);
+	g->width = cw+2*SDF_SPREAD;
+	g->height = ch+2*SDF_SPREAD;
+	if (!atlas_alloc(f,g)){
+		g->width = g->height = 0;//drawn as a space rather than over another glyph
+		arena_release(scratch,mark);
+		return;
+	}
+	for (int y = 0; y < g->height; y++){
+		for (int x = 0; x < g->width; x++){
+			int i = (y*SDF_SUPERSAMPLE+SDF_SUPERSAMPLE/2)*gw+x*SDF_SUPERSAMPLE+SDF_SUPERSAMPLE/2;//center of the base pixel
+			float d = (sqrtf(outside[i])-sqrtf(inside[i]))/SDF_SUPERSAMPLE;//base pixels, negative inside
+			image8_row(&f->atlas,g->y+y)[g->x+x] = CLAMP(0.5f-d/(2*SDF_SPREAD),0.0f,1.0f)*255;
+		}
+	}
+	arena_release(scratch,mark);
+	f->dirty = true;
+}
+
+void sdf_font_init(SDFFont *f, FT_Face face){
+	memset(f,0,sizeof(*f));
+	f->face = face;
+	GLint max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max_size);
+	f->max_height = MAX(SDF_ATLAS_SIZE,max_size);
+	image8_alloc(&f->atlas,SDF_ATLAS_SIZE,SDF_ATLAS_SIZE);
+	image8_clear(&f->atlas);
+	SDFGlyph *nine = sdf_get_glyph(f,'9');
+	f->cap_height = nine->height-2*SDF_SPREAD;
+}
+
+SDFGlyph *sdf_get_glyph(SDFFont *f, unsigned char c){
+	SDFGlyph *g = f->glyphs+c;
+	if (!g->loaded){
+		if (FT_Set_Pixel_Sizes(f->face,0,SDF_BASE_SIZE*SDF_SUPERSAMPLE)){
+			fatal_error("Failed to set freetype char size.");
+		}
+		double t = trace_begin();
+		generate_glyph(f,c,g);
+		trace_end("sdf glyph",t);
+	}
+	return g;
+}
+
+float sdf_string_width(SDFFont *f, float font_height, int char_count, char *string){
+	float width = 0;
+	for (int i = 0; i < char_count; i++){
+		width += sdf_get_glyph(f,string[i])->advance;
+	}
+	return width*font_height/SDF_BASE_SIZE;
+}
+
+void append_sdf_string(TextureColorVertexList *verts, SDFFont *f, float x, float y, float z, float font_height, uint32_t color, int char_count, char *string){
+	float scale = font_height/SDF_BASE_SIZE;
+	for (int i = 0; i < char_count; i++){
+		SDFGlyph *g = sdf_get_glyph(f,string[i]);
+		if (g->width){
+			float x0 = x+g->left*scale, x1 = x0+g->width*scale;
+			float y1 = y+g->top*scale, y0 = y1-g->height*scale;
+			float u0 = g->x, u1 = g->x+g->width;//texels, sdf_text_shader normalizes by the atlas size at draw time
+			float v0 = g->y, v1 = g->y+g->height;
+			TextureColorVertex *v = TextureColorVertexListMakeRoom(verts,6);
+			v[0] = (TextureColorVertex){{x0,y1,z},{u0,v0},color};
+			v[1] = (TextureColorVertex){{x0,y0,z},{u0,v1},color};
+			v[2] = (TextureColorVertex){{x1,y0,z},{u1,v1},color};
+			v[3] = v[2];
+			v[4] = (TextureColorVertex){{x1,y1,z},{u1,v0},color};
+			v[5] = v[0];
+		}
+		x += g->advance*scale;
+	}
+}
+
+void append_sdf_string_centered(TextureColorVertexList *verts, SDFFont *f, float x, float y, float z, float font_height, uint32_t color, int char_count, char *string){
+	x -= sdf_string_width(f,font_height,char_count,string)/2;
+	y -= f->cap_height*font_height/SDF_BASE_SIZE/2;
+	append_sdf_string(verts,f,x,y,z,font_height,color,char_count,string);
+}
+
+void sdf_font_bind(SDFFont *f){
+	if (!f->texture){
+		glGenTextures(1,&f->texture);
+		glBindTexture(GL_TEXTURE_2D,f->texture);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	} else {
+		glBindTexture(GL_TEXTURE_2D,f->texture);
+	}
+	if (f->dirty){
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,f->atlas.stride);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_R8,f->atlas.width,f->atlas.height,0,GL_RED,GL_UNSIGNED_BYTE,f->atlas.pixels);
+		upload_bytes += f->atlas.width*f->atlas.height;
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+		f->dirty = false;
+	}
+}
\ No newline at end of file
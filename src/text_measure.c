@@ -0,0 +1,126 @@
+#include <text_measure.h>
+#include <trace.h>
+
+static MeasureEntry *entries;
+static int total, used;
+
+static uint32_t measure_hash(FT_Face face, int font_height, char *string, int len){
+	uint32_t h = hash64(string,len);
+	h ^= (uint32_t)(uintptr_t)face*2654435761u;
+	h ^= (uint32_t)font_height*40503u;
+	return h;
+}
+
+static MeasureEntry *find_entry(MeasureEntry *table, int table_total, uint32_t hash, FT_Face face, int font_height, char *string, int len){
+	int index = hash % table_total;
+	while (1){
+		MeasureEntry *e = table+index;
+		if (!e->string) return e;
+		if (e->hash == hash && e->face == face && e->font_height == font_height && e->len == len && !memcmp(e->string,string,len)) return e;
+		index = (index + 1) % table_total;
+	}
+}
+
+static void grow(){
+	int new_total = total ? total*2 : 256;
+	MeasureEntry *new_entries = zalloc_or_die(new_total*sizeof(*new_entries));
+	for (MeasureEntry *e = entries; e < entries+total; e++){
+		if (e->string){
+			*find_entry(new_entries,new_total,e->hash,e->face,e->font_height,e->string,e->len) = *e;
+		}
+	}
+	free(entries);
+	entries = new_entries;
+	total = new_total;
+}
+
+static void include_ink(TextMetrics *m, float left, float top, float right, float bottom){
+	m->left = MIN(m->left,left);
+	m->top = MIN(m->top,top);
+	m->right = MAX(m->right,right);
+	m->bottom = MAX(m->bottom,bottom);
+}
+
+//font_height 0 measures in unhinted font units, otherwise in hinted pixels at that size
+static void measure_uncached(TextMetrics *m, FT_Face face, int font_height, int char_count, char *string){
+	FT_Int32 flags = FT_LOAD_DEFAULT;
+	FT_UInt kerning_mode = FT_KERNING_DEFAULT;
+	float unit = 1/64.0f;//26.6 fixed point
+	if (font_height){
+		if (FT_Set_Pixel_Sizes(face,0,font_height)){
+			fatal_error("Failed to set freetype char size.");
+		}
+	} else {
+		flags = FT_LOAD_NO_SCALE;
+		kerning_mode = FT_KERNING_UNSCALED;
+		unit = 1;
+	}
+	memset(m,0,sizeof(*m));
+	m->left = m->top = 1e30f;
+	m->right = m->bottom = -1e30f;
+	FT_UInt prev = 0;
+	for (int i = 0; i < char_count; i++){
+		FT_UInt glyph = FT_Get_Char_Index(face,(unsigned char)string[i]);
+		if (prev && glyph && FT_HAS_KERNING(face)){
+			FT_Vector k;
+			FT_Get_Kerning(face,prev,glyph,kerning_mode,&k);
+			m->kerning += k.x*unit;
+		}
+		if (FT_Load_Glyph(face,glyph,flags)){
+			fatal_error("Failed to load freetype glyph");
+		}
+		FT_Glyph_Metrics *gm = &face->glyph->metrics;
+		if (gm->width && gm->height){
+			float x = m->advance+m->kerning+gm->horiBearingX*unit;
+			float y = -gm->horiBearingY*unit;
+			include_ink(m,x,y,x+gm->width*unit,y+gm->height*unit);
+		}
+		m->advance += font_height ? (face->glyph->advance.x >> 6) : face->glyph->advance.x;//whole pixels per glyph like draw_string
+		prev = glyph;
+	}
+	if (m->left > m->right){
+		m->left = m->top = m->right = m->bottom = 0;
+	}
+}
+
+void measure_string(TextMetrics *m, FT_Face face, int font_height, int char_count, char *string){
+	int key_height = font_height <= MEASURE_HINTED_MAX_SIZE ? font_height : 0;
+	uint32_t hash = measure_hash(face,key_height,string,char_count);
+	MeasureEntry *e = total ? find_entry(entries,total,hash,face,key_height,string,char_count) : 0;
+	if (!e || !e->string){
+		if ((used+1) > (total*3)/4){ // 3/4 load limit
+			grow();
+			e = find_entry(entries,total,hash,face,key_height,string,char_count);
+		}
+		e->face = face;
+		e->font_height = key_height;
+		e->string = malloc_or_die(MAX(1,char_count));
+		memcpy(e->string,string,char_count);
+		e->len = char_count;
+		e->hash = hash;
+		double t = trace_begin();
+		measure_uncached(&e->metrics,face,key_height,char_count,string);
+		trace_end("measure_string",t);
+		used++;
+	}
+	*m = e->metrics;
+	if (!key_height){
+		float scale = (float)font_height/face->units_per_EM;
+		m->advance *= scale;
+		m->kerning *= scale;
+		m->left *= scale;
+		m->top *= scale;
+		m->right *= scale;
+		m->bottom *= scale;
+	}
+}
+
+void clear_measure_cache(){
+	for (MeasureEntry *e = entries; e < entries+total; e++){
+		free(e->string);
+	}
+	free(entries);
+	entries = 0;
+	total = 0;
+	used = 0;
+}
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include <tiled_effects.h>
+#include <trace.h>
+
+#define BAND_MIN_HALOS 4 //bands are at least this many halos tall, so the halo rows blurred twice add at most half the work
+
+//rows per band so a band, its halo rows and the effect's scratch copy of them fit in one image's share of the budget
+static int band_rows(size_t row_bytes, int halo){
+	size_t rows = memory_budget/IMAGE_BUDGET_SHARE/2/MAX(1,row_bytes);
+	int band = (int)MIN(rows,INT_MAX/4)-2*halo;
+	return MAX(MAX(1,BAND_MIN_HALOS*halo),band);
+}
+
+static void copy_rows(Image *dst, Image *src, int y0, int y1){
+	Image d = image_view(dst,0,y0,dst->width,y1-y0);
+	Image s = image_view(src,0,y0,src->width,y1-y0);
+	if (d.pixels != s.pixels) image_copy(&d,&s);
+}
+
+static void copy_rows8(Image8 *dst, Image8 *src, int y0, int y1){
+	Image8 d = image8_view(dst,0,y0,dst->width,y1-y0);
+	Image8 s = image8_view(src,0,y0,src->width,y1-y0);
+	if (d.pixels != s.pixels) image8_copy(&d,&s);
+}
+
+void tiled_copy(Image *dst, Image *src, Cancel *cancel){
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels),0);
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows(dst,src,y0,y1);
+		image_evict_rows(src,y0,y1);
+		image_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled8_copy(Image8 *dst, Image8 *src, Cancel *cancel){
+	int rows = band_rows(src->width,0);
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows8(dst,src,y0,y1);
+		image8_evict_rows(src,y0,y1);
+		image8_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled_clear(Image *img, Cancel *cancel){
+	int rows = band_rows((size_t)img->width*sizeof(*img->pixels),0);
+	for (int y0 = 0; y0 < img->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(img->height,y0+rows);
+		Image band = image_view(img,0,y0,img->width,y1-y0);
+		image_clear(&band);
+		image_evict_rows(img,y0,y1);
+	}
+}
+
+void tiled8_clear(Image8 *img, Cancel *cancel){
+	int rows = band_rows(img->width,0);
+	for (int y0 = 0; y0 < img->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(img->height,y0+rows);
+		Image8 band = image8_view(img,0,y0,img->width,y1-y0);
+		image8_clear(&band);
+		image8_evict_rows(img,y0,y1);
+	}
+}
+
+/*
+The gaussian blur reaches strength-1 pixels in each direction and the
+guided filter GUIDED_FILTER_PASSES*2*(strength-1), and bands span whole
+rows, so a band blurred with that many rows of halo above and below has
+exactly the full image's values everywhere outside the halo. At the
+image's top and bottom the halo is cut off just like the in-memory blurs
+clamp.
+*/
+static int blur_halo(int strength, bool guided){
+	return guided ? GUIDED_FILTER_PASSES*2*(strength-1) : strength-1;
+}
+
+void tiled_blur(Image *dst, Image *src, int strength, bool guided, Cancel *cancel){
+	int halo = blur_halo(strength,guided);
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels),halo);
+	Image buffer;
+	image_alloc(&buffer,src->width,MIN(src->height,rows+2*halo));
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		double t = trace_begin();
+		int y1 = MIN(src->height,y0+rows);
+		int h0 = MAX(0,y0-halo), h1 = MIN(src->height,y1+halo);
+		Image in = image_view(src,0,h0,src->width,h1-h0);
+		Image band = image_view(&buffer,0,0,src->width,h1-h0);
+		image_copy(&band,&in);
+		if (guided) img_guided_filter(&band,strength-1);
+		else img_gaussian_blur(&band,strength);
+		Image inner = image_view(&band,0,y0-h0,src->width,y1-y0);
+		Image out = image_view(dst,0,y0,dst->width,y1-y0);
+		image_copy(&out,&inner);
+		image_evict_rows(src,h0,h1);
+		image_evict_rows(dst,y0,y1);
+		trace_end("blur band",t);
+	}
+	image_free(&buffer);
+}
+
+void tiled_grey8_blur(Image8 *dst, Image *src, int strength, bool guided, Cancel *cancel){
+	int halo = blur_halo(strength,guided);
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels),halo);
+	Image8 buffer;
+	image8_alloc(&buffer,src->width,MIN(src->height,rows+2*halo));
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		double t = trace_begin();
+		int y1 = MIN(src->height,y0+rows);
+		int h0 = MAX(0,y0-halo), h1 = MIN(src->height,y1+halo);
+		Image in = image_view(src,0,h0,src->width,h1-h0);
+		Image8 band = image8_view(&buffer,0,0,src->width,h1-h0);
+		img_to_grey8(&band,&in);
+		if (guided) img8_guided_filter(&band,strength-1);
+		else img8_gaussian_blur(&band,strength);
+		Image8 inner = image8_view(&band,0,y0-h0,src->width,y1-y0);
+		Image8 out = image8_view(dst,0,y0,dst->width,y1-y0);
+		image8_copy(&out,&inner);
+		image_evict_rows(src,h0,h1);
+		image8_evict_rows(dst,y0,y1);
+		trace_end("blur band",t);
+	}
+	image8_free(&buffer);
+}
+
+void tiled_quantize(Image *dst, Image *src, int divisions, Cancel *cancel){
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels),0);
+	int mins[3] = {255,255,255};
+	int maxes[3] = {0,0,0};
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		Image band = image_view(src,0,y0,src->width,y1-y0);
+		img_channel_range(&band,mins,maxes);
+		image_evict_rows(src,y0,y1);
+	}
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows(dst,src,y0,y1);
+		Image band = image_view(dst,0,y0,dst->width,y1-y0);
+		img_quantize_range(&band,divisions,mins,maxes);
+		image_evict_rows(src,y0,y1);
+		image_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled8_quantize(Image8 *dst, Image8 *src, int divisions, Cancel *cancel){
+	int rows = band_rows(src->width,0);
+	int min = 255, max = 0;
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		Image8 band = image8_view(src,0,y0,src->width,y1-y0);
+		img8_range(&band,&min,&max);
+		image8_evict_rows(src,y0,y1);
+	}
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows8(dst,src,y0,y1);
+		Image8 band = image8_view(dst,0,y0,dst->width,y1-y0);
+		img8_quantize_range(&band,divisions,min,max);
+		image8_evict_rows(src,y0,y1);
+		image8_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled_palette_quantize(Image *dst, Image *src, int colors, Cancel *cancel){
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels),0);
+	Arena *scratch = scratch_arena();
+	ArenaMark mark = arena_mark(scratch);
+	ColorHistogram *h = arena_alloc(scratch,sizeof(*h));
+	Palette *p = arena_alloc(scratch,sizeof(*p));
+	histogram_clear(h);
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		Image band = image_view(src,0,y0,src->width,y1-y0);
+		histogram_add(h,&band);
+		image_evict_rows(src,y0,y1);
+	}
+	palette_build(p,h,colors);
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows(dst,src,y0,y1);
+		Image band = image_view(dst,0,y0,dst->width,y1-y0);
+		palette_apply(p,&band);
+		image_evict_rows(src,y0,y1);
+		image_evict_rows(dst,y0,y1);
+	}
+	arena_release(scratch,mark);
+}
+
+void tiled8_palette_quantize(Image8 *dst, Image8 *src, int colors, Cancel *cancel){
+	int rows = band_rows(src->width,0);
+	uint64_t hist[256] = {0};
+	uint8_t lut[256];
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		Image8 band = image8_view(src,0,y0,src->width,y1-y0);
+		grey_histogram_add(hist,&band);
+		image8_evict_rows(src,y0,y1);
+	}
+	grey_palette_build(lut,hist,colors);
+	for (int y0 = 0; y0 < src->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(src->height,y0+rows);
+		copy_rows8(dst,src,y0,y1);
+		Image8 band = image8_view(dst,0,y0,dst->width,y1-y0);
+		grey_palette_apply(lut,&band);
+		image8_evict_rows(src,y0,y1);
+		image8_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled_half(Image *dst, Image *src, Cancel *cancel){
+	int rows = band_rows((size_t)src->width*sizeof(*src->pixels)*2,0);//each row of dst reads two of src
+	for (int y0 = 0; y0 < dst->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(dst->height,y0+rows);
+		int s0 = y0*2, s1 = MIN(src->height,y1*2);
+		Image in = image_view(src,0,s0,src->width,MAX(1,s1-s0));
+		Image out = image_view(dst,0,y0,dst->width,y1-y0);
+		img_half_into(&out,&in);
+		image_evict_rows(src,s0,s1);
+		image_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled8_half(Image8 *dst, Image8 *src, Cancel *cancel){
+	int rows = band_rows((size_t)src->width*2,0);
+	for (int y0 = 0; y0 < dst->height; y0 += rows){
+		if (cancelled(cancel)) break;
+		int y1 = MIN(dst->height,y0+rows);
+		int s0 = y0*2, s1 = MIN(src->height,y1*2);
+		Image8 in = image8_view(src,0,s0,src->width,MAX(1,s1-s0));
+		Image8 out = image8_view(dst,0,y0,dst->width,y1-y0);
+		img8_half_into(&out,&in);
+		image8_evict_rows(src,s0,s1);
+		image8_evict_rows(dst,y0,y1);
+	}
+}
+
+void tiled_rect_decompose(Image *dst, Image *src, ColorRects *rects, int min_dim, Cancel *cancel){
+	ColorRects tile_rects = {0};
+	uint64_t tile_index = 0;//each tile's colors come from its own stream
+	for (int y0 = 0; y0 < src->height; y0 += DECOMPOSE_TILE_SIZE){
+		int y1 = MIN(src->height,y0+DECOMPOSE_TILE_SIZE);
+		for (int x0 = 0; x0 < src->width; x0 += DECOMPOSE_TILE_SIZE){
+			if (cancelled(cancel)) break;
+			int w = MIN(DECOMPOSE_TILE_SIZE,src->width-x0);
+			Image in = image_view(src,x0,y0,w,y1-y0);
+			Image tile = image_view(dst,x0,y0,w,y1-y0);
+			if (tile.pixels != in.pixels) image_copy(&tile,&in);
+			color_rects_clear(&tile_rects);
+			img_rect_decompose_parallel(&tile,&tile_rects,min_dim,tile_index++,cancel);
+			color_rects_append_moved(rects,&tile_rects,x0,y0);
+			//evicting whole rows drops the next tiles' parts too, they come back from the file when their turn comes
+			image_evict_rows(src,y0,y1);
+			image_evict_rows(dst,y0,y1);
+		}
+	}
+	color_rects_free(&tile_rects);
+}
+
+void tiled8_rect_decompose(Image *dst, Image8 *src, ColorRects *rects, int min_dim, Cancel *cancel){
+	ColorRects tile_rects = {0};
+	uint64_t tile_index = 0;
+	for (int y0 = 0; y0 < src->height; y0 += DECOMPOSE_TILE_SIZE){
+		int y1 = MIN(src->height,y0+DECOMPOSE_TILE_SIZE);
+		for (int x0 = 0; x0 < src->width; x0 += DECOMPOSE_TILE_SIZE){
+			if (cancelled(cancel)) break;
+			int w = MIN(DECOMPOSE_TILE_SIZE,src->width-x0);
+			Image8 in = image8_view(src,x0,y0,w,y1-y0);
+			Image tile = image_view(dst,x0,y0,w,y1-y0);
+			color_rects_clear(&tile_rects);
+			img8_rect_decompose_parallel(&in,&tile,&tile_rects,min_dim,tile_index++,cancel);
+			color_rects_append_moved(rects,&tile_rects,x0,y0);
+			image8_evict_rows(src,y0,y1);
+			image_evict_rows(dst,y0,y1);
+		}
+	}
+	color_rects_free(&tile_rects);
+}
\ No newline at end of file
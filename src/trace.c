@@ -0,0 +1,76 @@
+#include <trace.h>
+
+volatile int trace_enabled = 1;
+
+static TraceRing *rings[TRACE_MAX_THREADS];
+static volatile int ring_ready[TRACE_MAX_THREADS];//set once the slot's ring pointer is visible
+static volatile int ring_count;
+static THREAD_LOCAL TraceRing *ring;
+static THREAD_LOCAL bool no_ring;//all slots were taken, this thread isn't traced
+
+static TraceRing *get_ring(){
+	if (!ring && !no_ring){
+		int slot = atomic_add_int(&ring_count,1)-1;
+		if (slot >= TRACE_MAX_THREADS){
+			no_ring = true;
+			return 0;
+		}
+		ring = zalloc_or_die(sizeof(*ring));
+		ring->thread_name = "thread";
+		rings[slot] = ring;
+		atomic_store_int(ring_ready+slot,1);
+	}
+	return ring;
+}
+
+double trace_begin(){
+	return trace_enabled ? get_time() : 0;
+}
+
+void trace_end(char *name, double start){
+	if (!start) return;
+	TraceRing *r = get_ring();
+	if (!r) return;
+	int head = r->head;//only this thread writes head
+	TraceEvent *e = r->events+(head & (TRACE_RING_SIZE-1));
+	e->name = name;
+	e->start = start;
+	e->end = get_time();
+	atomic_store_int(&r->head,head+1);
+}
+
+void trace_thread_name(char *name){
+	TraceRing *r = get_ring();
+	if (r) r->thread_name = name;
+}
+
+void trace_dump(char *path){
+	FILE *f = fopen(path,"w");
+	if (!f){
+		fatal_error("trace_dump: failed to open %s",path);
+	}
+	TraceEvent *copy = malloc_or_die(TRACE_RING_SIZE*sizeof(*copy));
+	fprintf(f,"{\"traceEvents\":[\n");
+	bool first = true;
+	int count = MIN(TRACE_MAX_THREADS,atomic_load_int(&ring_count));
+	for (int tid = 0; tid < count; tid++){
+		if (!atomic_load_int(ring_ready+tid)) continue;//slot claimed but not filled in yet
+		TraceRing *r = rings[tid];
+		fprintf(f,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",first ? "" : ",\n",tid,r->thread_name);
+		first = false;
+		int head = atomic_load_int(&r->head);
+		int begin = MAX(0,head-TRACE_RING_SIZE);
+		for (int i = begin; i < head; i++){
+			copy[i-begin] = r->events[i & (TRACE_RING_SIZE-1)];
+		}
+		//anything the owner lapped while we copied is torn
+		begin = MAX(begin,atomic_load_int(&r->head)-TRACE_RING_SIZE);
+		for (int i = begin; i < head; i++){
+			TraceEvent *e = copy+i-MAX(0,head-TRACE_RING_SIZE);
+			fprintf(f,",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",e->name,tid,e->start*1e6,(e->end-e->start)*1e6);
+		}
+	}
+	fprintf(f,"\n]}\n");
+	free(copy);
+	fclose(f);
+}
\ No newline at end of file